@@ -0,0 +1,124 @@
+package ZxPinMap;
+
+# Reads the board's pin map, pin_map.txt, and works out where things go.
+# Used by gen_pin_header.pl and convert_roms.pl so they can't disagree.
+#
+# The address bus GPIOs are packed down into 14 bits in GPIO order: the
+# lowest numbered address GPIO is packed bit 0, and so on. That's what
+# PACK_ADDRESS_GPIOS() in the generated header does, with one shift and
+# mask per run of consecutive GPIOs.
+
+use strict;
+use warnings;
+
+our @SIGNALS = ( (map { "A$_" } 0..13), (map { "D$_" } 0..7), "ROM_ACCESS" );
+
+# Read and check the pin map. Returns a hash ref of signal name to GPIO.
+# Anything the firmware can't cope with is fatal: a signal missing or
+# given twice, two signals on one GPIO, or the data bus not on GPIO0-7
+# (the data bus is written with one store to the bottom byte of the
+# SIO's GPIO registers).
+#
+sub read_pin_map
+{
+  my( $map_file ) = @_;
+
+  my %gpio_of;
+  my %signal_on;
+
+  open( my $in, "<", $map_file ) or die( "Unable to open $map_file\n" );
+  while( my $line = <$in> )
+  {
+    $line =~ s/#.*//;
+    next if( $line =~ /^\s*$/ );
+
+    my( $signal, $gpio ) = $line =~ /^\s*(\w+)\s+(\d+)\s*$/
+      or die( "$map_file:$.: expected a signal name and a GPIO number\n" );
+
+    die( "$map_file:$.: $signal isn't a signal the firmware knows about\n" )
+      unless( grep { $_ eq $signal } @SIGNALS );
+    die( "$map_file:$.: $signal is given twice\n" )
+      if( exists $gpio_of{$signal} );
+    die( "$map_file:$.: GPIO$gpio doesn't exist\n" )
+      if( $gpio > 29 );
+    die( "$map_file:$.: GPIO$gpio is already $signal_on{$gpio}\n" )
+      if( exists $signal_on{$gpio} );
+
+    $gpio_of{$signal}  = $gpio;
+    $signal_on{$gpio} = $signal;
+  }
+  close( $in );
+
+  foreach my $signal (@SIGNALS)
+  {
+    die( "$map_file: no GPIO for $signal\n" ) unless( exists $gpio_of{$signal} );
+  }
+
+  foreach my $bit (0..7)
+  {
+    die( "$map_file: D$bit is on GPIO$gpio_of{\"D$bit\"}, the data bus must be on GPIO0-7\n" )
+      if( $gpio_of{"D$bit"} > 7 );
+  }
+
+  return \%gpio_of;
+}
+
+# The packed bit each address line ends up in, indexed by address bit
+#
+sub packed_bits
+{
+  my( $gpio_of ) = @_;
+
+  my @by_gpio = sort { $gpio_of->{"A$a"} <=> $gpio_of->{"A$b"} } 0..13;
+
+  my @packed_bit;
+  for( my $i=0; $i<14; $i++ )
+  {
+    $packed_bit[ $by_gpio[$i] ] = $i;
+  }
+  return @packed_bit;
+}
+
+# The packed GPIO pattern a Z80 address produces
+#
+sub pack_z80_address
+{
+  my( $packed_bit, $address ) = @_;
+
+  my $packed = 0;
+  foreach my $bit (0..13)
+  {
+    $packed |= 1 << $packed_bit->[$bit] if( $address & (1 << $bit) );
+  }
+  return $packed;
+}
+
+# A converted image rearranged for PERMUTED_ROM_IMAGES, padded out to
+# 16K. packed_address is indexed by Z80 address, see pack_z80_address.
+#
+sub permute_image
+{
+  my( $packed_address, @converted ) = @_;
+
+  push( @converted, (0xFF) x (16384 - @converted) );
+
+  my @permuted;
+  @permuted[ @$packed_address ] = @converted;
+  return @permuted;
+}
+
+# A ROM byte with its bits moved to where the data bus GPIOs want them
+#
+sub convert_byte
+{
+  my( $gpio_of, $byte ) = @_;
+
+  my $converted = 0;
+  foreach my $bit (0..7)
+  {
+    $converted |= 1 << $gpio_of->{"D$bit"} if( $byte & (1 << $bit) );
+  }
+  return $converted;
+}
+
+1;
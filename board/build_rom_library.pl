@@ -0,0 +1,129 @@
+#!/usr/bin/perl -w
+use strict;
+use FindBin;
+use lib $FindBin::Bin;
+use File::Basename;
+use ZxPinMap;
+
+# Build the ROM library, the firmware's flash resident collection of ROM
+# images (ROM_LIBRARY in the firmware source).
+#
+#  build_rom_library.pl pin_map.txt rom_library.txt rom_library.h
+#
+# rom_library.txt lists the ROMs, one per line: the .rom file, relative
+# to rom_library.txt, then the name the switcher banner shows for it.
+#
+# rom_library.h has the images back to back in rom_library, a 16K slot
+# each, already converted for the data bus so they can be copied straight
+# into the serving buffer. Like roms_converted.h there's a permuted copy
+# and a plain one and the firmware's PERMUTED_ROM_IMAGES picks which is
+# compiled. rom_library_index says where each image is and what it's
+# called. The library stays in flash; only the image being served is
+# ever in RAM.
+
+die( "Usage: $0 pin_map.txt rom_library.txt rom_library.h\n" ) unless( @ARGV == 3 );
+my( $map_file, $list_file, $out_file ) = @ARGV;
+
+my $gpio_of    = ZxPinMap::read_pin_map( $map_file );
+my @packed_bit = ZxPinMap::packed_bits( $gpio_of );
+
+my @converted_byte = map { ZxPinMap::convert_byte( $gpio_of, $_ ) } 0..255;
+my @packed_address = map { ZxPinMap::pack_z80_address( \@packed_bit, $_ ) } 0..16383;
+
+# Write out an array's bytes, 12 to a line like xxd does. With more set
+# there's more to come after them
+#
+sub print_bytes
+{
+  my( $out, $bytes, $more ) = @_;
+
+  for( my $i=0; $i<@$bytes; $i+=12 )
+  {
+    my $last = $i+11 < $#$bytes ? $i+11 : $#$bytes;
+    print $out "  ".join( ", ", map { sprintf( "0x%02x", $_ ) } @$bytes[$i..$last] );
+    print $out ( ($last == $#$bytes && !$more) ? "\n" : ",\n" );
+  }
+}
+
+# Read the list and the ROMs in it
+#
+my @entries = ();
+
+open( my $list, "<", $list_file ) or die( "Unable to open $list_file\n" );
+while( my $line = <$list> )
+{
+  $line =~ s/#.*//;
+  next if( $line =~ /^\s*$/ );
+
+  my( $rom_file, $name ) = $line =~ /^\s*(\S+)\s+(.*?)\s*$/
+    or die( "$list_file:$.: expected a ROM file and a name\n" );
+  die( "$list_file:$.: \"$name\" is longer than the banner's 32 characters\n" )
+    if( length( $name ) > 32 );
+  die( "$list_file:$.: \"$name\" can't have a double quote or a backslash in it\n" )
+    if( $name =~ /["\\]/ );
+
+  my $path = dirname( $list_file )."/$rom_file";
+  open( my $rom, "<:raw", $path ) or die( "$list_file:$.: unable to open $path\n" );
+  my @bytes = unpack( "C*", do { local $/; <$rom> } );
+  close( $rom );
+
+  die( "$list_file:$.: $rom_file is ".scalar(@bytes)." bytes, a ROM can't be more than 16K\n" )
+    if( @bytes > 16384 );
+  die( "$list_file:$.: $rom_file is empty\n" ) unless( @bytes );
+
+  # Centred in the banner, like the cycle_roms[] labels
+  my $pad   = 32 - length( $name );
+  my $label = (" " x int($pad/2)).$name.(" " x ($pad - int($pad/2)));
+
+  push( @entries, { file => $rom_file, label => $label, bytes => \@bytes } );
+}
+close( $list );
+
+die( "$list_file: no ROMs listed\n" ) unless( @entries );
+
+# Write the header
+#
+open( my $out, ">", $out_file ) or die( "Unable to open $out_file\n" );
+
+print $out "/* Generated from rom_library.txt and pin_map.txt by build_rom_library.pl, don't edit */\n\n";
+
+printf $out "#define ROM_LIBRARY_ENTRIES  %d\n\n", scalar(@entries);
+
+print $out <<"END";
+typedef struct _rom_library_entry
+{
+  uint32_t offset;        /* Into rom_library, always a multiple of 16K */
+  uint32_t rom_size;      /* As it was in the .rom file, the slot's padded with 0xFF */
+  char     label[ 33 ];   /* For the switcher banner */
+} ROM_LIBRARY_ENTRY;
+
+const ROM_LIBRARY_ENTRY rom_library_index[ ROM_LIBRARY_ENTRIES ] =
+{
+END
+for( my $i=0; $i<@entries; $i++ )
+{
+  printf $out "  { 0x%06x, %5d, \"%s\" },   /* %s */\n",
+              $i*16384, scalar(@{ $entries[$i]{bytes} }), $entries[$i]{label}, $entries[$i]{file};
+}
+print $out "};\n\n";
+
+foreach my $permuted (1, 0)
+{
+  print $out ( $permuted ? "#if PERMUTED_ROM_IMAGES\n" : "#else\n" );
+  print $out "const uint8_t rom_library[ ROM_LIBRARY_ENTRIES * 16384 ] __in_flash(\"rom_library\") __attribute__((aligned(4))) = {\n";
+  for( my $i=0; $i<@entries; $i++ )
+  {
+    my @converted = map { $converted_byte[$_] } @{ $entries[$i]{bytes} };
+    my @image = $permuted ? ZxPinMap::permute_image( \@packed_address, @converted )
+                          : ( @converted, ($converted_byte[0xFF]) x (16384 - @converted) );
+
+    print $out "/* $entries[$i]{file} */\n";
+    print_bytes( $out, \@image, $i < $#entries );
+  }
+  print $out "};\n";
+}
+print $out "#endif\n";
+
+close( $out );
+
+exit 0;
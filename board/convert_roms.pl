@@ -0,0 +1,184 @@
+#!/usr/bin/perl -w
+use strict;
+use FindBin;
+use lib $FindBin::Bin;
+use ZxPinMap;
+
+# Do the firmware's startup ROM conversion at build time.
+#
+#  convert_roms.pl pin_map.txt roms.h roms_converted.h [sw_rom_label.h]
+#
+# roms.h is copied to roms_converted.h with each of the __ROMs_* images
+# already converted for the data bus GPIOs. Each one is written out
+# twice: permuted for the packed address bus (PERMUTED_ROM_IMAGES), and
+# not. The firmware's #define picks which is compiled. Everything else in
+# roms.h (the switcher ROM, which gets its label patched in at runtime,
+# the ROM lists) is passed through as it is.
+#
+# On the end goes address_indirection_table_image, the firmware's
+# address indirection table, for builds which don't permute the images.
+#
+# Given sw_rom_label.h, which says where the label goes in the switcher
+# ROM, switcher_banner_images goes on the end too: a ready to run copy of
+# the switcher ROM for each entry in cycle_roms[], with that entry's
+# label in place. They're left out of ROM_LIBRARY builds, which have no
+# cycle_roms[].
+#
+# The names don't change, so the firmware includes roms_converted.h
+# instead of roms.h and everything else stays the same.
+
+die( "Usage: $0 pin_map.txt roms.h roms_converted.h [sw_rom_label.h]\n" ) unless( @ARGV == 3 || @ARGV == 4 );
+my( $map_file, $roms_file, $out_file, $label_file ) = @ARGV;
+
+my $gpio_of    = ZxPinMap::read_pin_map( $map_file );
+my @packed_bit = ZxPinMap::packed_bits( $gpio_of );
+
+my @converted_byte = map { ZxPinMap::convert_byte( $gpio_of, $_ ) } 0..255;
+my @packed_address = map { ZxPinMap::pack_z80_address( \@packed_bit, $_ ) } 0..16383;
+
+# Write out an array's bytes, 12 to a line like xxd does
+#
+sub print_bytes
+{
+  my( $out, $bytes ) = @_;
+
+  for( my $i=0; $i<@$bytes; $i+=12 )
+  {
+    my $last = $i+11 < $#$bytes ? $i+11 : $#$bytes;
+    print $out "  ".join( ", ", map { sprintf( "0x%02x", $_ ) } @$bytes[$i..$last] );
+    print $out ( $last == $#$bytes ? "\n" : ",\n" );
+  }
+}
+
+open( my $in,  "<", $roms_file ) or die( "Unable to open $roms_file\n" );
+open( my $out, ">", $out_file )  or die( "Unable to open $out_file\n" );
+
+print $out "/* Generated from roms.h and pin_map.txt by convert_roms.pl, don't edit */\n\n";
+
+# The switcher ROM, and the labels from the first cycle_roms[] (the
+# second is the Interface One one), are picked up on the way through
+#
+my @sw_rom = ();
+my @labels = ();
+my $in_cycle_roms = 0;
+
+while( my $line = <$in> )
+{
+  if( $line =~ /^unsigned char sw_rom\[\] = \{\s*$/ )
+  {
+    print $out $line;
+    while( ($line = <$in>) !~ /^\s*\};/ )
+    {
+      push( @sw_rom, map { hex } $line =~ /0x([0-9a-fA-F]{2})/g );
+      print $out $line;
+    }
+    print $out $line;
+  }
+  elsif( $line =~ /^const ROM_IMAGE cycle_roms\[\] =/ )
+  {
+    $in_cycle_roms = !@labels;
+    print $out $line;
+  }
+  elsif( $in_cycle_roms && $line =~ /^\s*\};/ )
+  {
+    $in_cycle_roms = 0;
+    print $out $line;
+  }
+  elsif( my( $decl ) = $line =~ /^(unsigned char __ROMs_\w+\[\]) = \{\s*$/ )
+  {
+    my @bytes = ();
+    while( ($line = <$in>) !~ /^\s*\};/ )
+    {
+      push( @bytes, map { hex } $line =~ /0x([0-9a-fA-F]{2})/g );
+    }
+
+    my @converted = map { $converted_byte[$_] } @bytes;
+
+    my @permuted = @converted;
+    if( @converted == 16384 )
+    {
+      @permuted = ZxPinMap::permute_image( \@packed_address, @converted );
+    }
+
+    print $out "#if PERMUTED_ROM_IMAGES\n";
+    print $out "$decl = {\n";
+    print_bytes( $out, \@permuted );
+    print $out "};\n";
+    print $out "#else\n";
+    print $out "$decl = {\n";
+    print_bytes( $out, \@converted );
+    print $out "};\n";
+    print $out "#endif\n";
+  }
+  else
+  {
+    push( @labels, $1 ) if( $in_cycle_roms && $line =~ /"([^"]*)"/ );
+    print $out $line;
+  }
+}
+close( $in );
+
+my @table = ();
+$table[ $packed_address[$_] ] = $_ foreach( 0..16383 );
+
+print $out "\n\n#if !PERMUTED_ROM_IMAGES\n";
+print $out "const uint16_t address_indirection_table_image[ 16384 ] = {\n";
+for( my $i=0; $i<16384; $i+=8 )
+{
+  print $out "  ".join( ", ", map { sprintf( "0x%04x", $_ ) } @table[$i..$i+7] );
+  print $out ( $i+8 < 16384 ? ",\n" : "\n" );
+}
+print $out "};\n";
+print $out "#endif\n";
+
+if( defined( $label_file ) )
+{
+  open( my $label_in, "<", $label_file ) or die( "Unable to open $label_file\n" );
+  my( $label_offset ) = join( "", <$label_in> ) =~ /#define\s+SW_ROM_LABEL_OFFSET\s+(0x[0-9a-fA-F]+|\d+)/
+    or die( "$label_file: no SW_ROM_LABEL_OFFSET\n" );
+  close( $label_in );
+  $label_offset = oct( $label_offset ) if( $label_offset =~ /^0x/ );
+
+  die( "$roms_file: no sw_rom or no cycle_roms[] labels\n" ) unless( @sw_rom && @labels );
+
+  # If the switcher ROM's been rebuilt without updating the label offset, it'll be wrong
+  my $placeholder = join( "", map { chr } @sw_rom[ $label_offset..$label_offset+31 ] );
+  die( "$label_file: there's no xxxx label at $label_offset in sw_rom, is it out of date?\n" )
+    unless( $placeholder eq "x" x 32 );
+
+  my @permuted_banners  = ();
+  my @converted_banners = ();
+  foreach my $label (@labels)
+  {
+    die( "$roms_file: switcher label \"$label\" isn't 32 characters\n" ) unless( length( $label ) == 32 );
+
+    my @banner = @sw_rom;
+    @banner[ $label_offset..$label_offset+31 ] = map { ord } split( //, $label );
+
+    my @converted = map { $converted_byte[$_] } @banner;
+    push( @converted_banners, \@converted );
+    push( @permuted_banners,  [ ZxPinMap::permute_image( \@packed_address, @converted ) ] );
+  }
+
+  print $out "\n\n#if !ZX_IF1_VERSION && !ROM_LIBRARY\n";
+  foreach my $permuted (1, 0)
+  {
+    my $banners = $permuted ? \@permuted_banners : \@converted_banners;
+
+    print $out ( $permuted ? "#if PERMUTED_ROM_IMAGES\n" : "#else\n" );
+    printf $out "uint8_t switcher_banner_images[ %d ][ %d ] = {\n", scalar(@$banners), scalar(@{ $banners->[0] });
+    for( my $i=0; $i<@$banners; $i++ )
+    {
+      print $out "{\n";
+      print_bytes( $out, $banners->[$i] );
+      print $out ( $i < $#$banners ? "},\n" : "}\n" );
+    }
+    print $out "};\n";
+  }
+  print $out "#endif\n";
+  print $out "#endif\n";
+}
+
+close( $out );
+
+exit 0;
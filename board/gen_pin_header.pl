@@ -0,0 +1,149 @@
+#!/usr/bin/perl -w
+use strict;
+use FindBin;
+use lib $FindBin::Bin;
+use ZxPinMap;
+
+# Generate zx_pico_pins.h from the board's pin map.
+#
+#  gen_pin_header.pl pin_map.txt zx_pico_pins.h
+#
+# The address bus GPIOs are in a weird order, so the firmware packs them
+# down into 14 bits, keeping them in GPIO order, and arranges the ROM
+# images to suit. This works out the packing: the address GPIOs fall
+# into runs of consecutive GPIOs, and each run needs one shift and one
+# mask. Fewer runs is fewer instructions on the serving path. The data
+# bus is similar: the ROM bytes are rearranged once at startup so they
+# can go straight onto the GPIOs, one shift and mask per distance a bit
+# has to move.
+#
+# Anything the firmware can't cope with in the pin map stops the build,
+# see ZxPinMap.pm.
+
+die( "Usage: $0 pin_map.txt zx_pico_pins.h\n" ) unless( @ARGV == 2 );
+my( $map_file, $header_file ) = @ARGV;
+
+my @signals = @ZxPinMap::SIGNALS;
+my %gpio_of = %{ ZxPinMap::read_pin_map( $map_file ) };
+
+# Address bus packing. Runs of consecutive GPIOs, in GPIO order, each
+# one landing in the packed value just above the one before.
+#
+my @address_gpios = sort { $a <=> $b } map { $gpio_of{"A$_"} } 0..13;
+
+my @runs = ();
+foreach my $gpio (@address_gpios)
+{
+  if( @runs && $runs[-1]{gpio} + $runs[-1]{length} == $gpio )
+  {
+    $runs[-1]{length}++;
+  }
+  else
+  {
+    my $packed = @runs ? $runs[-1]{packed} + $runs[-1]{length} : 0;
+    push( @runs, { gpio => $gpio, length => 1, packed => $packed } );
+  }
+}
+
+my @pack_terms = ();
+foreach my $run (@runs)
+{
+  $run->{shift} = $run->{gpio} - $run->{packed};
+  $run->{mask}  = ((1 << $run->{length}) - 1) << $run->{packed};
+
+  my $shifted = $run->{shift} > 0 ? "((g) >> $run->{shift})"
+              : $run->{shift} < 0 ? "((g) << ".(-$run->{shift}).")"
+              :                     "(g)";
+  push( @pack_terms, sprintf( "(%s & 0x%04X)", $shifted, $run->{mask} ) );
+}
+
+# Data bus. Group the bits by how far each has to move.
+#
+my %mask_for_shift;
+foreach my $bit (0..7)
+{
+  $mask_for_shift{ $gpio_of{"D$bit"} - $bit } |= 1 << $bit;
+}
+
+my @data_terms = ();
+foreach my $shift (sort { abs($a) <=> abs($b) || $b <=> $a } keys %mask_for_shift)
+{
+  my $masked = sprintf( "((b) & 0x%02X)", $mask_for_shift{$shift} );
+  push( @data_terms, $shift > 0 ? "($masked << $shift)"
+                   : $shift < 0 ? "($masked >> ".(-$shift).")"
+                   :              $masked );
+}
+
+# Write the header
+#
+open( my $out, ">", $header_file ) or die( "Unable to open $header_file\n" );
+
+print $out <<"END";
+/*
+ * Generated from pin_map.txt by gen_pin_header.pl. Don't edit this,
+ * edit pin_map.txt and rebuild.
+ */
+
+#ifndef ZX_PICO_PINS_H
+#define ZX_PICO_PINS_H
+
+END
+
+foreach my $signal (@signals)
+{
+  printf $out "#define PIN_%-14s %2d\n", "${signal}_GP", $gpio_of{$signal};
+}
+
+my $addr_gpio_mask = 0;
+$addr_gpio_mask |= 1 << $gpio_of{"A$_"} foreach( 0..13 );
+my $data_gpio_mask = 0;
+$data_gpio_mask |= 1 << $gpio_of{"D$_"} foreach( 0..7 );
+
+print $out <<"END";
+
+/* All the address bus GPIOs, and all the data bus GPIOs */
+END
+printf $out "#define PIN_ADDR_GPIO_MASK     0x%08X\n", $addr_gpio_mask;
+printf $out "#define PIN_DATA_GPIO_MASK     0x%08X\n", $data_gpio_mask;
+
+print $out <<"END";
+
+/*
+ * The address bus GPIOs, as runs of consecutive GPIOs. Each run is
+ * LENGTH GPIOs from GPIO upwards, and goes into the packed address at
+ * bit PACKED. That's a right shift by SHIFT (negative is a left shift)
+ * then MASK.
+ */
+END
+
+printf $out "#define PIN_ADDR_RUNS          %d\n", scalar(@runs);
+for( my $i=0; $i<@runs; $i++ )
+{
+  printf $out "\n";
+  printf $out "#define PIN_ADDR_RUN%d_GPIO     %d\n",     $i, $runs[$i]{gpio};
+  printf $out "#define PIN_ADDR_RUN%d_LENGTH   %d\n",     $i, $runs[$i]{length};
+  printf $out "#define PIN_ADDR_RUN%d_PACKED   %d\n",     $i, $runs[$i]{packed};
+  printf $out "#define PIN_ADDR_RUN%d_SHIFT    %d\n",     $i, $runs[$i]{shift};
+  printf $out "#define PIN_ADDR_RUN%d_MASK     0x%04X\n", $i, $runs[$i]{mask};
+}
+
+print $out <<"END";
+
+/* Pack the address bus GPIOs in g down into the bottom 14 bits */
+END
+print $out "#define PACK_ADDRESS_GPIOS(g)  ( ".join( " | ", @pack_terms )." )\n";
+
+print $out <<"END";
+
+/* Move the bits of ROM byte b to where the data bus GPIOs want them */
+END
+print $out "#define DATA_BYTE_TO_GPIOS(b)  ( ".join( " | ", @data_terms )." )\n";
+
+print $out <<"END";
+
+#endif
+END
+
+close( $out );
+
+exit 0;
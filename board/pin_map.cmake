@@ -0,0 +1,98 @@
+# Build steps driven by the board's pin map, for the firmware targets.
+# The outputs are regenerated when the pin map, the scripts or the input
+# changes, and go on the target's include path.
+#
+#  include(${CMAKE_CURRENT_LIST_DIR}/../board/pin_map.cmake)
+#
+#  zx_generate_pin_header(target)
+#    zx_pico_pins.h, the pin numbers and the bus bit shuffles. See
+#    gen_pin_header.pl.
+#
+#  zx_generate_converted_roms(target roms.h [sw_rom_label.h])
+#    roms_converted.h, roms.h with the ROM images already converted and
+#    the address indirection table precomputed. With the switcher ROM's
+#    label header, the switcher banner images too. See convert_roms.pl.
+#
+#  zx_generate_rom_library(target rom_library.txt)
+#    rom_library.h, the ROM library: every ROM in the list converted and
+#    packed into one flash resident array, with an index. See
+#    build_rom_library.pl.
+
+find_package(Perl REQUIRED)
+
+set(ZX_BOARD_DIR ${CMAKE_CURRENT_LIST_DIR})
+
+function(zx_generate_pin_header TARGET)
+  set(PIN_HEADER_DIR ${CMAKE_CURRENT_BINARY_DIR}/${TARGET}_pins)
+
+  add_custom_command(
+    OUTPUT ${PIN_HEADER_DIR}/zx_pico_pins.h
+    COMMAND ${CMAKE_COMMAND} -E make_directory ${PIN_HEADER_DIR}
+    COMMAND ${PERL_EXECUTABLE} ${ZX_BOARD_DIR}/gen_pin_header.pl
+            ${ZX_BOARD_DIR}/pin_map.txt ${PIN_HEADER_DIR}/zx_pico_pins.h
+    DEPENDS ${ZX_BOARD_DIR}/pin_map.txt ${ZX_BOARD_DIR}/gen_pin_header.pl
+            ${ZX_BOARD_DIR}/ZxPinMap.pm
+    COMMENT "Generating zx_pico_pins.h from the pin map"
+    VERBATIM
+  )
+
+  add_custom_target(${TARGET}_pin_header DEPENDS ${PIN_HEADER_DIR}/zx_pico_pins.h)
+  add_dependencies(${TARGET} ${TARGET}_pin_header)
+  target_include_directories(${TARGET} PRIVATE ${PIN_HEADER_DIR})
+endfunction()
+
+function(zx_generate_converted_roms TARGET ROMS_HEADER)
+  set(ROMS_DIR ${CMAKE_CURRENT_BINARY_DIR}/${TARGET}_roms)
+  get_filename_component(ROMS_HEADER ${ROMS_HEADER} ABSOLUTE)
+
+  set(LABEL_HEADER "")
+  if (ARGC GREATER 2)
+    get_filename_component(LABEL_HEADER ${ARGV2} ABSOLUTE)
+  endif()
+
+  add_custom_command(
+    OUTPUT ${ROMS_DIR}/roms_converted.h
+    COMMAND ${CMAKE_COMMAND} -E make_directory ${ROMS_DIR}
+    COMMAND ${PERL_EXECUTABLE} ${ZX_BOARD_DIR}/convert_roms.pl
+            ${ZX_BOARD_DIR}/pin_map.txt ${ROMS_HEADER} ${ROMS_DIR}/roms_converted.h
+            ${LABEL_HEADER}
+    DEPENDS ${ZX_BOARD_DIR}/pin_map.txt ${ZX_BOARD_DIR}/convert_roms.pl
+            ${ZX_BOARD_DIR}/ZxPinMap.pm ${ROMS_HEADER} ${LABEL_HEADER}
+    COMMENT "Converting the ROM images for the pin map"
+    VERBATIM
+  )
+
+  add_custom_target(${TARGET}_converted_roms DEPENDS ${ROMS_DIR}/roms_converted.h)
+  add_dependencies(${TARGET} ${TARGET}_converted_roms)
+  target_include_directories(${TARGET} PRIVATE ${ROMS_DIR})
+endfunction()
+
+function(zx_generate_rom_library TARGET LIST_FILE)
+  set(LIBRARY_DIR ${CMAKE_CURRENT_BINARY_DIR}/${TARGET}_rom_library)
+  get_filename_component(LIST_FILE ${LIST_FILE} ABSOLUTE)
+  get_filename_component(LIST_DIR ${LIST_FILE} DIRECTORY)
+
+  # The ROM files are dependencies too, and adding one means reconfiguring
+  set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS ${LIST_FILE})
+  file(STRINGS ${LIST_FILE} LIST_LINES REGEX "^[ \t]*[^# \t]")
+  set(ROM_FILES "")
+  foreach(LINE ${LIST_LINES})
+    string(REGEX MATCH "^[ \t]*([^ \t]+)" ROM_FILE "${LINE}")
+    list(APPEND ROM_FILES ${LIST_DIR}/${CMAKE_MATCH_1})
+  endforeach()
+
+  add_custom_command(
+    OUTPUT ${LIBRARY_DIR}/rom_library.h
+    COMMAND ${CMAKE_COMMAND} -E make_directory ${LIBRARY_DIR}
+    COMMAND ${PERL_EXECUTABLE} ${ZX_BOARD_DIR}/build_rom_library.pl
+            ${ZX_BOARD_DIR}/pin_map.txt ${LIST_FILE} ${LIBRARY_DIR}/rom_library.h
+    DEPENDS ${ZX_BOARD_DIR}/pin_map.txt ${ZX_BOARD_DIR}/build_rom_library.pl
+            ${ZX_BOARD_DIR}/ZxPinMap.pm ${LIST_FILE} ${ROM_FILES}
+    COMMENT "Building the ROM library"
+    VERBATIM
+  )
+
+  add_custom_target(${TARGET}_rom_library DEPENDS ${LIBRARY_DIR}/rom_library.h)
+  add_dependencies(${TARGET} ${TARGET}_rom_library)
+  target_include_directories(${TARGET} PRIVATE ${LIBRARY_DIR})
+endfunction()
@@ -0,0 +1,47 @@
+# Run after the link with -DNM=... -DOBJDUMP=... -DELF=...
+#
+# Checks the serving path symbols landed in the banks sram_placement.cmake
+# reserved for them, that the ROM library stayed in flash, and that the serving loop doesn't reference anything
+# in flash (0x10000000-0x13FFFFFF, XIP and its aliases).
+
+execute_process(COMMAND ${NM} ${ELF} OUTPUT_VARIABLE SYMBOLS RESULT_VARIABLE RESULT)
+if (NOT RESULT EQUAL 0)
+  message(FATAL_ERROR "nm failed on ${ELF}")
+endif()
+
+# check_symbol(name low high required)
+function(check_symbol NAME LOW HIGH REQUIRED)
+  string(REGEX MATCH "([0-9a-fA-F]+) [A-Za-z] ${NAME}\n" LINE "${SYMBOLS}")
+  if (NOT LINE)
+    if (REQUIRED)
+      message(FATAL_ERROR "placement: ${NAME} not found in ${ELF}")
+    endif()
+    return()
+  endif()
+  math(EXPR ADDRESS "0x${CMAKE_MATCH_1}")
+  if (ADDRESS LESS ${LOW} OR NOT ADDRESS LESS ${HIGH})
+    message(FATAL_ERROR "placement: ${NAME} is at 0x${CMAKE_MATCH_1}, outside its bank")
+  endif()
+  message(STATUS "placement: ${NAME} at 0x${CMAKE_MATCH_1}")
+endfunction()
+
+#            symbol                     bank       low          high         required
+check_symbol(serve_rom_reads            0x20040000 0x20041000 TRUE)  # SCRATCH_X
+check_symbol(serve_rom_reads_asm        0x20040000 0x20041000 FALSE) # SCRATCH_X
+check_symbol(address_indirection_table  0x21020000 0x21030000 FALSE) # SRAM2
+check_symbol(serving_image              0x21030000 0x21040000 FALSE) # SRAM3
+check_symbol(rom_library                0x10000000 0x11000000 FALSE) # Flash, it won't fit in RAM
+
+# Anything the serving loop refers to through its literal pool or a
+# branch shows up as an address in the disassembly
+execute_process(COMMAND ${OBJDUMP} -d --disassemble=serve_rom_reads ${ELF}
+                OUTPUT_VARIABLE LISTING RESULT_VARIABLE RESULT)
+if (NOT RESULT EQUAL 0)
+  message(FATAL_ERROR "objdump failed on ${ELF}")
+endif()
+
+set(HEX "[0-9a-fA-F]")
+string(REGEX MATCHALL "[^0-9a-fA-Fx](0x)?1[0-3]${HEX}${HEX}${HEX}${HEX}${HEX}${HEX}[^0-9a-fA-F]" FLASH_REFS "${LISTING}")
+if (FLASH_REFS)
+  message(FATAL_ERROR "placement: serve_rom_reads refers to flash: ${FLASH_REFS}")
+endif()
@@ -1372,6 +1372,12 @@ const unsigned int __ROMs_if1_rom_len = 16384;
 
 #endif    /* Interface One version */
 
+/*
+ * With ROM_LIBRARY the ROMs come out of the library in flash instead,
+ * see rom_library.txt. These would only take up RAM.
+ */
+#if !ROM_LIBRARY
+
 unsigned char __ROMs_retroleum_diag_v59_rom[] = {
   0xf3, 0x31, 0x00, 0x00, 0xed, 0x56, 0xaf, 0xed, 0x47, 0xc3, 0x4b, 0x01,
   0x44, 0x49, 0x41, 0x47, 0x52, 0x4f, 0x4d, 0x20, 0x56, 0x31, 0x2e, 0x35,
@@ -5480,6 +5486,8 @@ unsigned char __ROMs_48_original_rom[] = {
 };
 const unsigned int __ROMs_48_original_rom_len = 16384;
 
+#endif    /* !ROM_LIBRARY */
+
 unsigned char sw_rom[] = {
   0x2e, 0x38, 0xcd, 0x88, 0x04, 0x2e, 0x00, 0xcd, 0x78, 0x04, 0x21, 0xe0,
   0x00, 0xe5, 0x3e, 0x01, 0xf5, 0x33, 0xaf, 0xf5, 0x33, 0xcd, 0x56, 0x00,
@@ -5594,7 +5602,11 @@ typedef struct _rom_image
 } ROM_IMAGE;
 
 
-#if !ZX_IF1_VERSION
+#if ROM_LIBRARY
+
+/* The button steps through the ROM library, there's no cycle_roms[] */
+
+#elif !ZX_IF1_VERSION
 
 /*
  * This is the list of ROM images which are cycled, in sequence, as the
@@ -5630,4 +5642,6 @@ const ROM_IMAGE cycle_roms[] =
 
 #endif    /* Interface One version */
 
+#if !ROM_LIBRARY
 uint8_t num_cycle_roms   = (sizeof(cycle_roms)   / sizeof(ROM_IMAGE));
+#endif
@@ -0,0 +1,61 @@
+# SRAM bank placement for the ROM serving path.
+#
+# The SDK's copy_to_ram linker script puts everything in the striped RAM
+# alias, which spreads every buffer across all four main SRAM banks. This
+# takes that script and changes the memory map to:
+#
+#   RAM    0x21000000  128K  SRAM0 and SRAM1, non-striped. Everything else.
+#   SRAM2  0x21020000   64K  .sram2_bank, the address indirection table
+#   SRAM3  0x21030000   64K  .sram3_bank, the image being served
+#
+# SCRATCH_X (SRAM4) holds the serving loop, SCRATCH_Y (SRAM5) holds the
+# core0 stack, as usual. After the link the map is checked so a misplaced
+# symbol fails the build rather than showing up as a crashed Spectrum.
+
+function(zx_sram_placement TARGET)
+
+  pico_set_binary_type(${TARGET} copy_to_ram)
+
+  # Find the SDK's RP2040 copy_to_ram script, it moved in SDK 2.0
+  file(GLOB_RECURSE SDK_COPY_TO_RAM_LD ${PICO_SDK_PATH}/src/rp2_common/*/memmap_copy_to_ram.ld)
+  list(FILTER SDK_COPY_TO_RAM_LD EXCLUDE REGEX "rp2350")
+  list(LENGTH SDK_COPY_TO_RAM_LD FOUND)
+  if (NOT FOUND EQUAL 1)
+    message(FATAL_ERROR "Can't find the SDK's RP2040 memmap_copy_to_ram.ld")
+  endif()
+
+  file(READ ${SDK_COPY_TO_RAM_LD} LD)
+
+  string(REGEX REPLACE
+    "RAM\\(rwx\\) *: *ORIGIN *= *0x20000000 *, *LENGTH *= *256k"
+    "RAM(rwx) : ORIGIN = 0x21000000, LENGTH = 128k\n    SRAM2(rw) : ORIGIN = 0x21020000, LENGTH = 64k\n    SRAM3(rw) : ORIGIN = 0x21030000, LENGTH = 64k"
+    LD_PLACED "${LD}")
+  if (LD_PLACED STREQUAL LD)
+    message(FATAL_ERROR "Unexpected RAM region in ${SDK_COPY_TO_RAM_LD}")
+  endif()
+
+  # The banks are filled at runtime, so they're not loaded
+  set(LD "${LD_PLACED}")
+  string(REGEX REPLACE
+    "(\n[ \t]*\\.scratch_x[ \t]*:)"
+    "\n    .sram2_bank (NOLOAD) : { *(.sram2_bank*) } > SRAM2\n    .sram3_bank (NOLOAD) : { *(.sram3_bank*) } > SRAM3\n\\1"
+    LD_PLACED "${LD}")
+  if (LD_PLACED STREQUAL LD)
+    message(FATAL_ERROR "Can't find the .scratch_x section in ${SDK_COPY_TO_RAM_LD}")
+  endif()
+
+  set(PLACED_LD ${CMAKE_CURRENT_BINARY_DIR}/memmap_sram_placement.ld)
+  file(WRITE ${PLACED_LD} "${LD_PLACED}")
+
+  pico_set_linker_script(${TARGET} ${PLACED_LD})
+  target_compile_definitions(${TARGET} PRIVATE SRAM_PLACEMENT=1)
+
+  add_custom_command(TARGET ${TARGET} POST_BUILD
+    COMMAND ${CMAKE_COMMAND}
+            -DNM=${CMAKE_NM}
+            -DOBJDUMP=${CMAKE_OBJDUMP}
+            -DELF=$<TARGET_FILE:${TARGET}>
+            -P ${CMAKE_CURRENT_LIST_DIR}/check_placement.cmake
+    VERBATIM)
+
+endfunction()
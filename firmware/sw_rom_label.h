@@ -0,0 +1,7 @@
+/*
+ * Where the row of 32 x's, the label of the ROM coming up, is in the
+ * switcher ROM image (sw_rom in roms.h). This is maintained by hand. If
+ * the switcher is rebuilt, find the x's in the new sw.rom and update it;
+ * convert_roms.pl stops the build if it no longer points at them.
+ */
+#define SW_ROM_LABEL_OFFSET 0x0122
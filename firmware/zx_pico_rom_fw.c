@@ -20,6 +20,310 @@
 /* Switch out the multiple ROM features, switch in the Interface One paging */
 #define ZX_IF1_VERSION 0
 
+/*
+ * Selects how the ROM bytes are served to the Z80.
+ *
+ * SERVE_CPU_LOOP is the original spin loop on core0. It needs an overclock.
+ *
+ * SERVE_PIO_DMA uses a PIO state machine to catch the ROM access and the
+ * address, and a pair of chained DMA channels to do the lookup and pass the
+ * byte to another PIO state machine which drives the data bus. The CPU
+ * isn't involved in a ROM read at all; the response time is fixed by the
+ * PIO and DMA timings. See rom_serve.pio.
+ *
+ * SERVE_CPU_INTERP is the CPU loop with the address bus unscrambling done
+ * by the SIO interpolators instead of shifts and masks. See
+ * setup_interp_address_unpacking().
+ *
+ * SERVE_CPU_SPECULATIVE doesn't wait for ROM_ACCESS before doing the
+ * lookup. While the ROM isn't being accessed it keeps looking up and
+ * driving the byte for whatever address is on the bus. The address is
+ * stable well before /MREQ falls and the level shifter is gated by the
+ * hardware, so the right byte is usually on the GPIOs before the shifter
+ * opens. That takes the lookup off the M1 deadline.
+ *
+ * SERVE_CPU_ASM is the spin loop hand written in Thumb assembly, with a
+ * cycle budget for each instruction. It meets the M1 deadline at the stock
+ * 125MHz so there's no overclock. It needs PERMUTED_ROM_IMAGES and doesn't
+ * do the IF1 paging. See serve_rom_asm.S.
+ *
+ * SERVE_PIO_CPU is a halfway house. A PIO state machine waits for
+ * ROM_ACCESS and snapshots the GPIOs a fixed 3 PIO cycles after the edge,
+ * then passes the snapshot to the CPU through its RX FIFO. The CPU does
+ * the lookup, the data bus, the paging and anything else in C as usual,
+ * but the address is always sampled at the same moment and the CPU doesn't
+ * wait for the read to finish. See rom_access_snapshot in rom_serve.pio.
+ */
+#define SERVE_CPU_LOOP         0
+#define SERVE_PIO_DMA          1
+#define SERVE_CPU_INTERP       2
+#define SERVE_CPU_SPECULATIVE  3
+#define SERVE_CPU_ASM          4
+#define SERVE_PIO_CPU          5
+
+#define SERVING_ENGINE  SERVE_CPU_LOOP
+
+/*
+ * With the speculative engine, count how often the byte already on the
+ * data bus when ROM_ACCESS was seen was the right one. The counts are in
+ * speculation_hits and speculation_misses, read them with the debugger.
+ * Counting is done after the read completes, off the critical path.
+ */
+#define SPECULATION_STATS 1
+
+/*
+ * ROM storage format. When this is 1 each ROM image is rearranged at
+ * startup so the byte the Z80 wants for address A is at the offset given
+ * by packing the GPIO pattern A produces. The packed GPIO value indexes
+ * the ROM directly, so the indirection table (and its load on every ROM
+ * read) goes away. See permute_rom().
+ */
+#define PERMUTED_ROM_IMAGES 1
+
+/*
+ * With PRECONVERTED_ROMS the ROM images are converted for the data bus,
+ * and permuted if PERMUTED_ROM_IMAGES is set, when the firmware is built
+ * instead of at every power up. The build runs board/convert_roms.pl over
+ * roms.h to make roms_converted.h, which also has the address
+ * indirection table in it ready made. There's nothing to work out while
+ * the Spectrum is held in reset, the table is just copied into place.
+ * z80_released_at_us says how long the Spectrum was held.
+ */
+#define PRECONVERTED_ROMS 1
+
+/*
+ * FAST_BOOT gets the Spectrum going as soon as possible after power up.
+ * Only what the serving loop needs is done before the Z80 is let out of
+ * reset: the clock, the bus GPIOs (all set up at once with mask
+ * operations) and the serving engine. Core1 lets the Z80 go the moment
+ * core0 is about to enter the serving loop rather than 5ms later from an
+ * alarm, and only then does the button, the LED and its blip. With this
+ * at 0 the LED blips for half a second before the Z80 starts, which is
+ * most of the time the Spectrum sits there showing random colours.
+ *
+ * Either way first_rom_access_at_us is when core1 saw the Z80's first ROM
+ * read, in microseconds from power up. Read it with the debugger.
+ */
+#define FAST_BOOT 1
+
+/*
+ * ROM switching, see run_rom_switch(). The switcher ROM's banner is up
+ * for SWITCH_BANNER_MS before the next ROM starts; 0 is direct mode,
+ * no banner, the button goes straight to the next ROM. The Z80 is held
+ * in reset for SWITCH_RESET_US each time it's restarted. The button has
+ * to be let go for SWITCH_DEBOUNCE_US before another press counts.
+ */
+#define SWITCH_BANNER_MS    1200
+#define SWITCH_RESET_US     1000
+#define SWITCH_DEBOUNCE_US  50000
+
+/*
+ * With SINGLE_STORE_DBUS the serving loop puts each ROM byte on the data
+ * bus with one store instead of calling gpio_put_masked(). See
+ * put_data_bus(). Set DBUS_OUTPUT_BENCHMARK to time both ways at startup.
+ */
+#define SINGLE_STORE_DBUS      1
+#define DBUS_OUTPUT_BENCHMARK  0
+
+/*
+ * M1 aware serving, for the v1.2 board which has /M1 on GPIO15. The C
+ * serving loop looks at /M1 in the same GPIO sample as the address and
+ * splits into two paths once the byte is on the data bus.
+ *
+ * Opcode fetch (/M1 low). /MREQ to the Z80 sampling the data is 1.5
+ * T-states, about 430ns. Nothing is added to this path: the byte goes out
+ * and the loop waits for the read to end. The refresh cycle follows
+ * immediately, about 140ns after /MREQ goes high, and shows up as a ROM
+ * access whenever the I register is below 0x40. Nobody reads the data
+ * bus in a refresh, so the loop being late for it doesn't matter. The
+ * IF1 paging traps are opcode fetches, so they're checked on this path,
+ * straight after the byte has gone out. See PAGING_TRAPS.
+ *
+ * Operand and data reads (/M1 high), and refresh cycles. /MREQ to the
+ * data being sampled is 2 T-states, about 570ns, and /MREQ then stays
+ * low until the middle of T3. The byte goes out first, the same as for
+ * a fetch, so the extra work (the counters and the read trace) runs
+ * while the Z80 is still finishing the read. From /MREQ going high
+ * there's at least one T-state (285ns) until the next /MREQ. Keep the
+ * extra work under about 300ns, 45 cycles at 150MHz, and it can never
+ * make the loop late for the next access.
+ *
+ * Boards without /M1 connected read GPIO15 as high, via the pull-up, so
+ * everything goes down the slower path. That still works, it just costs
+ * a few cycles.
+ *
+ * It defaults to on for the Interface One build, which can't page
+ * properly without /M1, and off otherwise. Set it to 1 here, or with the
+ * ZX_M1_AWARE_SERVING CMake option, to use it in the plain build too.
+ */
+#ifndef M1_AWARE_SERVING
+#define M1_AWARE_SERVING  ZX_IF1_VERSION
+#endif
+
+/*
+ * Boot time clock calibration, for the C serving loops. Instead of the
+ * fixed OVERCLOCK, the serving loop's critical path is timed with SysTick
+ * while the Z80 is held in reset, and the lowest system clock which gets
+ * the byte out inside the M1 budget, with CALIBRATION_MARGIN_PERCENT of
+ * the budget to spare, is chosen. See calibrate_sys_clock(). The choice
+ * is left in calibrated_sys_khz.
+ *
+ * To reuse a calibration, read calibrated_sys_khz with the debugger and
+ * put it in CALIBRATED_SYS_KHZ. The measurement is then skipped and that
+ * clock is used from power up. 0 calibrates on every boot.
+ *
+ * The margin is generous because the cycle count only covers the code.
+ * The scope says the plain C loop needs 140MHz where its instruction
+ * count says 125MHz is plenty, so something else (XIP cache misses, the
+ * refresh cycle straight after M1) eats into the budget as well.
+ */
+#define CLOCK_CALIBRATION           0
+#define CALIBRATION_MARGIN_PERCENT  40
+#define CALIBRATED_SYS_KHZ          0
+
+/*
+ * Glitch filter for ROM_ACCESS, for SERVE_PIO_CPU. ROM_ACCESS comes
+ * straight from the discrete logic decoding A14, A15 and /MREQ, and one
+ * noisy low sample is enough for the loop to serve (and with the IF1
+ * paging, maybe act on) an address which was never read. With this set
+ * to N the snapshot SM only passes on a ROM access when ROM_ACCESS has
+ * stayed low and the address hasn't changed for N samples after the
+ * first. 0 is no filtering. Each sample is 7 PIO cycles; the extra
+ * latency, in ns, is in rom_access_filter_latency_ns. See
+ * rom_access_filtered in rom_serve.pio. It all comes out of the M1
+ * budget, so the build stops if N is more than the clock can take (1 or
+ * 2 at 150MHz), see ROM_ACCESS_FILTER_CYCLES.
+ *
+ * The filter watches GPIO8 up to GPIO26, and the LED on GPIO25 is in
+ * among them. With the filter on the LED isn't used, so core1 can't
+ * keep restarting it.
+ */
+#define ROM_ACCESS_FILTER_SAMPLES  0
+
+/*
+ * Deadline monitoring, for the C serving loops. A late byte doesn't show
+ * up as anything except a crashed Spectrum, so the loop checks each read
+ * once the byte is out: if ROM_ACCESS has already gone high the Z80
+ * finished the read before the byte got there. That costs a GPIO read and
+ * a couple of counter updates after the byte is out, off the critical
+ * path, while the Z80 is still busy with the read. Refresh cycles which
+ * hit the ROM are counted too; nobody reads the bus during those, but the
+ * loop is no slower for them, so a late one still means something.
+ *
+ * Set DEADLINE_THRESHOLD_CYCLES to also time each read, with SysTick,
+ * from the spin loop seeing ROM_ACCESS to the byte going out. Reads over
+ * the threshold are counted and the worst is kept. That does put a
+ * SysTick read on the critical path, so it's 0 (off) by default. It
+ * can't see how long the edge waited for the spin loop to notice it,
+ * that's one time round the loop at most.
+ *
+ * Core1 reports the counters once a second, see report_serving_counters().
+ * The PIO/DMA engine and the assembly loop don't keep them, so it can't
+ * be used with those. It's a diagnostic and it does add to every read,
+ * so it's off by default.
+ */
+#define DEADLINE_MONITOR           0
+#define DEADLINE_THRESHOLD_CYCLES  0
+
+/*
+ * HOT_SWAP lets the ROM be changed under a running Spectrum, for trying
+ * out ROM patches without losing the machine state to a reset. A
+ * debugger writes the request into hot_swap_request, see
+ * service_hot_swap_request(). Core1 builds the patched image in a
+ * staging buffer and sends it to the serving core, which switches to it
+ * between two ROM reads. It costs 48K of RAM so it's off by default.
+ */
+#define HOT_SWAP          0
+#define HOT_SWAP_MAX_PATCH 16384
+
+/*
+ * ROM_LIBRARY makes the button step through the ROM library instead of
+ * cycle_roms[]. The library is built from rom_library.txt and lives in
+ * flash, which has room for far more ROMs than RAM does. A DMA channel
+ * copies the image to be served out of flash at power up and on each
+ * switch. See stage_library_image(). The ROMs in roms.h, cycle_roms[] and
+ * the prebuilt banners aren't compiled in, so what's left in RAM is the
+ * serving buffer, one banner, and the switcher ROM it's made from.
+ */
+#define ROM_LIBRARY  0
+
+/* Entries in the read trace, must be a power of 2 */
+#define READ_TRACE_LENGTH 256
+
+/*
+ * SRAM_PLACEMENT is set by the ZX_SRAM_PLACEMENT CMake option, which also
+ * provides the linker script. The whole binary is copied to RAM so nothing
+ * comes from flash, the serving loop runs from the scratch_x bank, the
+ * image being served is copied into SRAM3 and the indirection table lives
+ * in SRAM2. Core0 stack is in scratch_y. Nothing else uses those banks, so
+ * the serving loop's accesses never wait for another bus master or an XIP
+ * cache miss. The build checks the link map, see check_placement.cmake.
+ */
+#ifndef SRAM_PLACEMENT
+#define SRAM_PLACEMENT 0
+#endif
+
+/* Everything except the PIO/DMA engine and the assembly loop runs the spin loop in C */
+#define SERVING_LOOP_IN_C  ( (SERVING_ENGINE != SERVE_PIO_DMA) && (SERVING_ENGINE != SERVE_CPU_ASM) )
+
+/*
+ * The paging traps, see load_paging_traps(). The Interface One build is
+ * the only one which loads a trap set.
+ */
+#define PAGING_TRAPS  ZX_IF1_VERSION
+
+#if PAGING_TRAPS && !SERVING_LOOP_IN_C
+#error "The Interface One paging needs the C serving loop"
+#endif
+
+#if PAGING_TRAPS && !M1_AWARE_SERVING
+#error "The paging traps are opcode fetches, they need M1_AWARE_SERVING (v1.2 board)"
+#endif
+
+#if (SERVING_ENGINE == SERVE_CPU_ASM) && !PERMUTED_ROM_IMAGES
+#error "The assembly serving loop needs PERMUTED_ROM_IMAGES"
+#endif
+
+#if M1_AWARE_SERVING && !SERVING_LOOP_IN_C
+#error "M1_AWARE_SERVING needs the C serving loop"
+#endif
+
+#if DEADLINE_THRESHOLD_CYCLES && (SERVING_ENGINE == SERVE_CPU_SPECULATIVE)
+#error "The speculative engine drives the bus before it sees ROM_ACCESS, there's nothing to time"
+#endif
+
+#if ROM_ACCESS_FILTER_SAMPLES && (SERVING_ENGINE != SERVE_PIO_CPU)
+#error "ROM_ACCESS_FILTER_SAMPLES is for the SERVE_PIO_CPU engine"
+#endif
+
+
+#if ROM_ACCESS_FILTER_SAMPLES > 32
+#error "ROM_ACCESS_FILTER_SAMPLES can be 32 at most"
+#endif
+
+/* The LED is inside the span the glitch filter watches */
+#define LED_IN_USE  !ROM_ACCESS_FILTER_SAMPLES
+
+#if DEADLINE_MONITOR && !SERVING_LOOP_IN_C
+#error "DEADLINE_MONITOR is for the C serving loops, the others don't keep the counters"
+#endif
+
+#if DEADLINE_THRESHOLD_CYCLES && !DEADLINE_MONITOR
+#error "DEADLINE_THRESHOLD_CYCLES is part of DEADLINE_MONITOR"
+#endif
+
+#if CLOCK_CALIBRATION && !SERVING_LOOP_IN_C
+#error "CLOCK_CALIBRATION is for the C serving loops, the others run at 125MHz"
+#endif
+
+#if HOT_SWAP && ZX_IF1_VERSION
+#error "HOT_SWAP needs core1 to be able to send images, the Interface One build doesn't"
+#endif
+
+#if ROM_LIBRARY && ZX_IF1_VERSION
+#error "The Interface One build doesn't switch ROMs, it has no use for ROM_LIBRARY"
+#endif
+
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
@@ -28,6 +332,67 @@
 #include "hardware/gpio.h"
 #include "pico/binary_info.h"
 #include "hardware/timer.h"
+#include "pico/multicore.h"
+#include "zx_pico_pins.h"
+
+#if (SERVING_ENGINE == SERVE_PIO_DMA) || (SERVING_ENGINE == SERVE_PIO_CPU)
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/structs/bus_ctrl.h"
+#include "rom_serve.pio.h"
+
+/*
+ * The PIO programs can't see the pin map, ROM_ACCESS and the address
+ * packing are written into them. Stop the build if the pin map has moved
+ * things. See rom_serve.pio.
+ */
+#if PIN_ROM_ACCESS_GP != 8
+#error "The PIO programs in rom_serve.pio expect ROM_ACCESS on GPIO8"
+#endif
+#if ROM_ACCESS_FILTER_SAMPLES && (PIN_ADDR_GPIO_MASK & ~0x07FFFF00)
+#error "The rom_access_filtered program in rom_serve.pio expects the address bus in GPIO8-26"
+#endif
+#if (SERVING_ENGINE == SERVE_PIO_DMA) && \
+    ( (PIN_ADDR_RUNS != 3) || \
+      (PIN_ADDR_RUN0_GPIO != 9)  || (PIN_ADDR_RUN0_LENGTH != 6) || \
+      (PIN_ADDR_RUN1_GPIO != 16) || (PIN_ADDR_RUN1_LENGTH != 7) || \
+      (PIN_ADDR_RUN2_GPIO != 26) || (PIN_ADDR_RUN2_LENGTH != 1) )
+#error "The rom_address program in rom_serve.pio doesn't match the pin map's address bus"
+#endif
+
+#endif
+
+#if SERVING_ENGINE == SERVE_CPU_INTERP
+#include "hardware/interp.h"
+#endif
+
+#if CLOCK_CALIBRATION || DEADLINE_MONITOR || ROM_ACCESS_FILTER_SAMPLES
+#include "hardware/clocks.h"
+#include "hardware/structs/systick.h"
+#include "hardware/regs/m0plus.h"
+#endif
+
+#if SRAM_PLACEMENT
+#define SERVING_LOOP_PLACEMENT       __scratch_x("serve_rom_reads")
+#define SERVING_IMAGE_PLACEMENT      __attribute__((section(".sram3_bank")))
+#define INDIRECTION_TABLE_PLACEMENT  __attribute__((section(".sram2_bank")))
+#else
+#define SERVING_LOOP_PLACEMENT
+#define SERVING_IMAGE_PLACEMENT
+#define INDIRECTION_TABLE_PLACEMENT
+#endif
+
+/*
+ * The PIO/DMA engine, and the SRAM placement, serve a copy of the active
+ * ROM image from a buffer of their own. The IF1 paging swaps images on the
+ * fly so it can't work from a copy; with SRAM_PLACEMENT it serves straight
+ * from the images, which are still in RAM.
+ */
+#define SERVE_FROM_COPY  ( (SERVING_ENGINE == SERVE_PIO_DMA) || (SRAM_PLACEMENT && !ZX_IF1_VERSION) )
+
+#if HOT_SWAP && SERVE_FROM_COPY
+#error "HOT_SWAP switches the serving core between images, it can't work with the one serving buffer"
+#endif
 
 
 /* 1 instruction on the 133MHz microprocessor is 7.5ns */
@@ -35,40 +400,94 @@
 /* 1 instruction on the 150MHz microprocessor is 6.6ns */
 /* 1 instruction on the 200MHz microprocessor is 5.0ns */
 
+#if SERVING_LOOP_IN_C && !CLOCK_CALIBRATION
 #define OVERCLOCK 150000
 //#define OVERCLOCK 200000
+#endif
+
+/*
+ * The M1 budget is /MREQ going low to the Z80 sampling the data bus on
+ * an opcode fetch. Out of that comes the ROM_ACCESS logic, the level
+ * shifter and the Z80's data setup time, which is what BUS_DELAY_NS is.
+ */
+#define M1_BUDGET_NS        430
+#define BUS_DELAY_NS         80
+
+#if ROM_ACCESS_FILTER_SAMPLES
+
+/*
+ * The glitch filter's time comes out of the M1 budget. Its snapshot
+ * reaches the FIFO ROM_ACCESS_FILTER_CYCLES PIO cycles after ROM_ACCESS
+ * goes low, counting the input synchroniser, where the unfiltered one
+ * takes ROM_ACCESS_SNAPSHOT_CYCLES (see rom_serve.pio). After that the
+ * CPU needs up to ROM_ACCESS_FILTER_CPU_NS to notice the snapshot, look
+ * the byte up and put it out: 25 cycles or so at 150MHz, with a little
+ * spare. Calibration can pick a clock as low as 125MHz, so that's what
+ * it's checked at then. In practice that allows 1 or 2 samples.
+ */
+#define ROM_ACCESS_SNAPSHOT_CYCLES  5
+#define ROM_ACCESS_FILTER_CYCLES    (7*ROM_ACCESS_FILTER_SAMPLES + 11)
+#define ROM_ACCESS_FILTER_CPU_NS    170
+
+#ifdef OVERCLOCK
+#define ROM_ACCESS_FILTER_CHECK_KHZ  OVERCLOCK
+#else
+#define ROM_ACCESS_FILTER_CHECK_KHZ  125000
+#endif
+
+#if ROM_ACCESS_FILTER_CYCLES * 1000000 / ROM_ACCESS_FILTER_CHECK_KHZ > M1_BUDGET_NS - BUS_DELAY_NS - ROM_ACCESS_FILTER_CPU_NS
+#error "ROM_ACCESS_FILTER_SAMPLES is too high, the filtered snapshot would miss the M1 deadline"
+#endif
+
+#endif
 
+#if PRECONVERTED_ROMS
+#include "roms_converted.h"
+#else
 #include "roms.h"
+#endif
+
+#if !ZX_IF1_VERSION
+#include "sw_rom_label.h"
+#endif
+
+#if ROM_LIBRARY
+#include "hardware/dma.h"
+#include "rom_library.h"
+#endif
 
 const uint8_t LED_PIN = PICO_DEFAULT_LED_PIN;
 
 /*
  * These pin values are the GPxx ones in green background on the pinout diagram.
- * See schematic for how the signals are fed into the Pico's GPIOs
- */
-const uint8_t A0_GP          = 11;
-const uint8_t A1_GP          = 12;
-const uint8_t A2_GP          = 13;
-const uint8_t A3_GP          = 14;
-const uint8_t A4_GP          = 20;
-const uint8_t A5_GP          = 21;
-const uint8_t A6_GP          = 22;
-const uint8_t A7_GP          = 26;
-const uint8_t A8_GP          = 19;
-const uint8_t A9_GP          = 18;
-const uint8_t A10_GP         = 17;
-const uint8_t A11_GP         = 16;
-const uint8_t A12_GP         = 10;
-const uint8_t A13_GP         = 9;
+ * See schematic for how the signals are fed into the Pico's GPIOs. They come
+ * from board/pin_map.txt, via the generated zx_pico_pins.h.
+ */
+const uint8_t A0_GP          = PIN_A0_GP;
+const uint8_t A1_GP          = PIN_A1_GP;
+const uint8_t A2_GP          = PIN_A2_GP;
+const uint8_t A3_GP          = PIN_A3_GP;
+const uint8_t A4_GP          = PIN_A4_GP;
+const uint8_t A5_GP          = PIN_A5_GP;
+const uint8_t A6_GP          = PIN_A6_GP;
+const uint8_t A7_GP          = PIN_A7_GP;
+const uint8_t A8_GP          = PIN_A8_GP;
+const uint8_t A9_GP          = PIN_A9_GP;
+const uint8_t A10_GP         = PIN_A10_GP;
+const uint8_t A11_GP         = PIN_A11_GP;
+const uint8_t A12_GP         = PIN_A12_GP;
+const uint8_t A13_GP         = PIN_A13_GP;
 
 /*
  * Given the GPIOs with an address bus value on them, this packs the
- * 14 address bits down into the least significant 14 bits
+ * 14 address bits down into the least significant 14 bits. The shifts
+ * and masks are generated from the pin map, one of each per run of
+ * consecutive address GPIOs. With the v1.2 board that's GPIO9-14 to
+ * bits 0-5, GPIO16-22 to bits 6-12 and GPIO26 to bit 13.
  */
 inline uint16_t pack_address_gpios( uint32_t gpios )
 {
-  /*     Bits 0,1,2,3,4,5       Bits 6,7,8,9,10,11,12     Bit 13                   */
-  return ((gpios>>9) & 0x03F) | ((gpios>>10) & 0x1FC0) | ((gpios & 0x4000000) >> 13);
+  return PACK_ADDRESS_GPIOS( gpios );
 }
 
 /*
@@ -97,14 +516,14 @@ uint32_t create_gpios_for_address( uint32_t i )
 }
 
 
-const uint8_t  D0_GP          = 0;
-const uint8_t  D1_GP          = 1;
-const uint8_t  D2_GP          = 2;
-const uint8_t  D3_GP          = 4; 
-const uint8_t  D4_GP          = 6;
-const uint8_t  D5_GP          = 3;
-const uint8_t  D6_GP          = 5;
-const uint8_t  D7_GP          = 7;
+const uint8_t  D0_GP          = PIN_D0_GP;
+const uint8_t  D1_GP          = PIN_D1_GP;
+const uint8_t  D2_GP          = PIN_D2_GP;
+const uint8_t  D3_GP          = PIN_D3_GP;
+const uint8_t  D4_GP          = PIN_D4_GP;
+const uint8_t  D5_GP          = PIN_D5_GP;
+const uint8_t  D6_GP          = PIN_D6_GP;
+const uint8_t  D7_GP          = PIN_D7_GP;
 
 const uint32_t  D0_BIT_MASK  = ((uint32_t)1 <<  D0_GP);
 const uint32_t  D1_BIT_MASK  = ((uint32_t)1 <<  D1_GP);
@@ -115,7 +534,7 @@ const uint32_t  D5_BIT_MASK  = ((uint32_t)1 <<  D5_GP);
 const uint32_t  D6_BIT_MASK  = ((uint32_t)1 <<  D6_GP);
 const uint32_t  D7_BIT_MASK  = ((uint32_t)1 <<  D7_GP);
 
-const uint8_t  ROM_ACCESS_GP            = 8;
+const uint8_t  ROM_ACCESS_GP            = PIN_ROM_ACCESS_GP;
 const uint32_t ROM_ACCESS_BIT_MASK      = ((uint32_t)1 << ROM_ACCESS_GP);
 
 /* This pin triggers a transistor which shorts the Z80's /RESET to ground */
@@ -129,6 +548,10 @@ const uint32_t PICO_USER_INPUT_BIT_MASK = ((uint32_t)1 << PICO_USER_INPUT_GP);
 
 #endif
 
+/* The Z80's /M1, on the v1.2 board. Active low */
+const uint8_t  M1_GP                    = 15;
+const uint32_t M1_BIT_MASK              = ((uint32_t)1 << M1_GP);
+
 const uint32_t DBUS_MASK     = ((uint32_t)1 << D0_GP) |
                                ((uint32_t)1 << D1_GP) |
                                ((uint32_t)1 << D2_GP) |
@@ -138,6 +561,79 @@ const uint32_t DBUS_MASK     = ((uint32_t)1 << D0_GP) |
                                ((uint32_t)1 << D6_GP) |
                                ((uint32_t)1 << D7_GP);
 
+/*
+ * Put a ROM byte on the data bus. driven is the byte already there, the
+ * return value is the byte there now; the serving loop keeps it in a
+ * register for next time.
+ *
+ * gpio_put_masked() reads gpio_out, XORs in the value, masks it and
+ * writes the result to gpio_togl. The read of gpio_out is on the critical
+ * path and everything after it depends on it. D0-D7 are GPIO0-7 and
+ * nothing but the serving loop drives them, so the bits which need to
+ * change are just driven^value, which is already confined to the bottom
+ * byte. One store to gpio_togl does it.
+ *
+ * A byte store to the bottom lane of gpio_out would be neater, but the
+ * RP2040's IO registers don't do narrow writes, the byte is replicated
+ * across all four lanes and would hit the LED and reset pins as well.
+ *
+ * From the instruction timings (SIO accesses are single cycle):
+ *
+ *                      SIO read   eor   and   SIO write   cycles
+ *   gpio_put_masked       1        1     1        1          4
+ *   single store          -        1     -        1          2
+ *
+ * 2 cycles is 13ns at 150MHz. DBUS_OUTPUT_BENCHMARK measures it.
+ */
+static inline uint8_t put_data_bus( uint8_t value, uint8_t driven )
+{
+#if SINGLE_STORE_DBUS
+  sio_hw->gpio_togl = driven ^ value;
+#else
+  gpio_put_masked( DBUS_MASK, value );
+#endif
+  return value;
+}
+
+/* The byte on the data bus GPIOs, before the serving loop takes them over */
+static inline uint8_t data_bus_state( void )
+{
+  return (uint8_t)sio_hw->gpio_out;
+}
+
+#if DBUS_OUTPUT_BENCHMARK
+
+/*
+ * Time for 100,000 data bus writes each way, in microseconds. Read them
+ * with the debugger. Only run while the Z80 is held in reset.
+ */
+volatile uint32_t dbus_put_masked_us;
+volatile uint32_t dbus_single_store_us;
+
+void benchmark_dbus_output( void )
+{
+  uint32_t i, start;
+  uint8_t  driven = data_bus_state();
+
+  start = time_us_32();
+  for( i=0; i<100000; i++ )
+    gpio_put_masked( DBUS_MASK, (uint8_t)i );
+  dbus_put_masked_us = time_us_32() - start;
+
+  driven = data_bus_state();
+  start = time_us_32();
+  for( i=0; i<100000; i++ )
+  {
+    sio_hw->gpio_togl = driven ^ (uint8_t)i;
+    driven = (uint8_t)i;
+  }
+  dbus_single_store_us = time_us_32() - start;
+
+  gpio_put_masked( DBUS_MASK, 0 );
+}
+
+#endif
+
 /*
  * The 14 address bus bits arrive on the GPIOs in a weird pattern which is
  * defined by the edge connector layout and the board design. Shifting all
@@ -160,8 +656,13 @@ const uint32_t DBUS_MASK     = ((uint32_t)1 << D0_GP) |
  *
  * This table is filled in at the start; a lookup is done here for each
  * ROM byte read.
+ *
+ * With PERMUTED_ROM_IMAGES the ROM images themselves are rearranged
+ * instead, and this table isn't needed.
  */
-uint16_t address_indirection_table[ 16384 ];
+#if !PERMUTED_ROM_IMAGES
+uint16_t address_indirection_table[ 16384 ] INDIRECTION_TABLE_PLACEMENT;
+#endif
 
 
 /*
@@ -176,23 +677,95 @@ void preconvert_rom( uint8_t *image_ptr, uint32_t length )
   for( conv_index=0; conv_index < length; conv_index++ )
   {
     uint8_t rom_byte = *(image_ptr+conv_index);
-    *(image_ptr+conv_index) =  (rom_byte & 0x87)       |        /* bxxx xbbb */
-                              ((rom_byte & 0x08) << 1) |        /* xxxb xxxx */
-                              ((rom_byte & 0x10) << 2) |        /* xbxx xxxx */
-                              ((rom_byte & 0x20) >> 2) |        /* xxxx bxxx */
-                              ((rom_byte & 0x40) >> 1);         /* xxbx xxxx */
+
+    /* Generated from the pin map, one shift and mask per distance moved */
+    *(image_ptr+conv_index) = DATA_BYTE_TO_GPIOS( rom_byte );
+  }
+}
+
+/*
+ * Given a Z80 address, this gives the value the packed GPIOs will have
+ * when that address is on the bus.
+ */
+uint16_t pack_z80_address( uint16_t address )
+{
+  return pack_address_gpios( create_gpios_for_address( address ) );
+}
+
+/*
+ * Where in an image the byte for a Z80 address is. That's the offset the
+ * serving loop calls rom_address.
+ */
+uint16_t image_offset_for_z80_address( uint16_t address )
+{
+#if PERMUTED_ROM_IMAGES
+  return pack_z80_address( address );
+#else
+  return address;
+#endif
+}
+
+
+#if PERMUTED_ROM_IMAGES
+
+/* Which offsets permute_rom() has already filled in */
+uint32_t permuted_offsets[ 16384/32 ];
+
+/*
+ * Rearrange a 16K ROM image in place so the byte the Z80 wants for
+ * address A is at offset pack_z80_address(A). That's a permutation, so
+ * it's done by following each cycle round: the byte in hand goes to its
+ * new place, the byte it displaces is picked up and moved on, and so on
+ * until the cycle gets back to where it started. The bitmap stops a cycle
+ * being walked twice.
+ */
+void permute_rom( uint8_t *image_ptr )
+{
+  uint32_t start;
+
+  memset( permuted_offsets, 0, sizeof(permuted_offsets) );
+
+  for( start=0; start < 16384; start++ )
+  {
+    if( permuted_offsets[start/32] & ((uint32_t)1 << (start%32)) )
+      continue;
+
+    uint32_t from    = start;
+    uint8_t  carried = *(image_ptr+start);
+    do
+    {
+      uint32_t to        = pack_z80_address( from );
+      uint8_t  displaced = *(image_ptr+to);
+
+      *(image_ptr+to) = carried;
+      permuted_offsets[to/32] |= ((uint32_t)1 << (to%32));
+
+      carried = displaced;
+      from    = to;
+    }
+    while( from != start );
   }
 }
 
+#endif
+
+
+#if !ROM_LIBRARY
+
 void preconvert_rom_image( uint8_t rom_index )
 {
   preconvert_rom( cycle_roms[rom_index].rom_data, cycle_roms[rom_index].rom_size ); 
+
+#if PERMUTED_ROM_IMAGES
+  permute_rom( cycle_roms[rom_index].rom_data );
+#endif
 }
 
 /*
  * Loop over all the ROM images in the header file and convert their bit
  * patterns to match the order of bits of the data bus. It's quicker to
  * preconvert these at the start than to fiddle the bits each read cycle.
+ * With PERMUTED_ROM_IMAGES the images are rearranged here too.
  */
 void preconvert_roms( void )
 {
@@ -203,6 +776,139 @@ void preconvert_roms( void )
   }  
 }
 
+#endif
+
+
+#if SERVING_ENGINE == SERVE_CPU_INTERP
+
+/* Three lanes, one per run of address GPIOs, and they can only shift right */
+#if (PIN_ADDR_RUNS != 3) || (PIN_ADDR_RUN0_SHIFT < 1) || (PIN_ADDR_RUN1_SHIFT < 1) || (PIN_ADDR_RUN2_SHIFT < 1)
+#error "SERVE_CPU_INTERP needs the address bus GPIOs in 3 runs, each above its packed position"
+#endif
+
+/*
+ * Program the interpolators so that writing the GPIO state into them
+ * produces the address of the indirection table entry directly. Each
+ * interpolator lane does (accumulator >> shift) & mask, and interp0's
+ * FULL result adds both its lanes to base2.
+ *
+ * The table holds 16 bit values, so the packed pattern is wanted shifted
+ * up by one bit, and everything is one bit lower in the shifts:
+ *
+ *  interp0 lane 0: GPIO9-14  >> 8, mask bits 1-6    (packed bits 0-5)
+ *  interp0 lane 1: GPIO16-22 >> 9, mask bits 7-13   (packed bits 6-12)
+ *  interp0 base 2: address of address_indirection_table
+ *  interp1 lane 0: GPIO26    >> 12, mask bit 14     (packed bit 13)
+ *
+ * Those are the v1.2 board's figures. The code takes them from the
+ * address GPIO runs in the pin map, one lane per run.
+ *
+ * With PERMUTED_ROM_IMAGES there's no table. The shifts are one more, the
+ * masks one bit lower, base 2 is zero and the result is the offset into
+ * the ROM image.
+ *
+ * GPIO26 (A7) is on its own and too far from the others to be caught
+ * by a contiguous mask, hence the second interpolator and the one add.
+ * The interpolators are per-core, this must be called on the core which
+ * runs the serving loop.
+ *
+ * Cycle counts, from ROM_ACCESS going low to the data bus being written,
+ * counted from the generated instructions (Cortex-M0+, SIO accesses are
+ * single cycle, other loads 2). These are worst case, with the ROM_ACCESS
+ * edge just missed by the spin loop:
+ *
+ *                       spin+sync  unscramble  ROM load  output   total
+ *   shifts and masks       8          11          4        4       27
+ *   interpolators          8           7          4        4       23
+ *
+ *               125MHz   133MHz   150MHz   200MHz
+ *   27 cycles    216ns    203ns    180ns    135ns
+ *   23 cycles    184ns    173ns    153ns    115ns
+ *
+ * Both look to be comfortably inside 430ns, but the scope says the shift
+ * and mask loop needs 140MHz, so the real loop is being held up by other
+ * things: code fetches from flash, the refresh cycle which follows M1 and
+ * the time spent waiting for ROM_ACCESS to go away. The interpolators
+ * take 4 cycles (30ns at 133MHz) off the critical path, which isn't
+ * enough on its own to lose the OVERCLOCK define.
+ */
+void setup_interp_address_unpacking( void )
+{
+  interp_config cfg;
+
+#if PERMUTED_ROM_IMAGES
+  const uint entry_shift = 0;
+  const uint32_t table   = 0;
+#else
+  const uint entry_shift = 1;
+  const uint32_t table   = (uint32_t)address_indirection_table;
+#endif
+
+  cfg = interp_default_config();
+  interp_config_set_shift( &cfg, PIN_ADDR_RUN0_SHIFT-entry_shift );
+  interp_config_set_mask( &cfg, PIN_ADDR_RUN0_PACKED+entry_shift, PIN_ADDR_RUN0_PACKED+PIN_ADDR_RUN0_LENGTH-1+entry_shift );
+  interp_set_config( interp0, 0, &cfg );
+
+  /* Lane 1 works on the same value as lane 0 */
+  cfg = interp_default_config();
+  interp_config_set_cross_input( &cfg, true );
+  interp_config_set_shift( &cfg, PIN_ADDR_RUN1_SHIFT-entry_shift );
+  interp_config_set_mask( &cfg, PIN_ADDR_RUN1_PACKED+entry_shift, PIN_ADDR_RUN1_PACKED+PIN_ADDR_RUN1_LENGTH-1+entry_shift );
+  interp_set_config( interp0, 1, &cfg );
+
+  interp_set_base( interp0, 0, 0 );
+  interp_set_base( interp0, 1, 0 );
+  interp_set_base( interp0, 2, table );
+
+  cfg = interp_default_config();
+  interp_config_set_shift( &cfg, PIN_ADDR_RUN2_SHIFT-entry_shift );
+  interp_config_set_mask( &cfg, PIN_ADDR_RUN2_PACKED+entry_shift, PIN_ADDR_RUN2_PACKED+PIN_ADDR_RUN2_LENGTH-1+entry_shift );
+  interp_set_config( interp1, 0, &cfg );
+
+  interp_set_base( interp1, 0, 0 );
+}
+
+#endif
+
+#if SERVING_LOOP_IN_C
+
+/*
+ * The offset into the ROM image of the byte the Z80 wants, given the GPIO
+ * state sampled when ROM_ACCESS went low. With PERMUTED_ROM_IMAGES that's
+ * the packed GPIO pattern, not the Z80's address. This is the serving
+ * loop's critical path; it's forced inline so the loop's code doesn't
+ * change, and so the clock calibration can time exactly the same thing.
+ */
+static __force_inline uint16_t rom_offset_for_gpios( uint32_t gpios_state )
+{
+#if SERVING_ENGINE == SERVE_CPU_INTERP
+
+  interp0->accum[0] = gpios_state;
+  interp1->accum[0] = gpios_state;
+
+#if PERMUTED_ROM_IMAGES
+  /* Interpolators give the offset into the permuted ROM image */
+  return interp0->peek[2] + interp1->peek[0];
+#else
+  /* Interpolators give the address of the indirection table entry */
+  return *(uint16_t *)(interp0->peek[2] + interp1->peek[0]);
+#endif
+
+#elif PERMUTED_ROM_IMAGES
+
+  return pack_address_gpios( gpios_state );
+
+#else
+
+  register uint16_t raw_bit_pattern = pack_address_gpios( gpios_state );
+
+  return address_indirection_table[raw_bit_pattern];
+
+#endif
+}
+
+#endif
+
 
 /* From the timer_lowlevel.c example */
 uint64_t get_time_us( void )
@@ -212,6 +918,8 @@ uint64_t get_time_us( void )
   return ((uint64_t)hi << 32u) | lo;
 }
 
+#if !PERMUTED_ROM_IMAGES
+
 /*
  * Populate the address bus indirection table.
  */
@@ -238,58 +946,1479 @@ void create_indirection_table( void )
   return;
 }
 
+#endif
+
+
+#if !ZX_IF1_VERSION
+
+#if ROM_LIBRARY
+
+/* Library entry 0, staged into RAM at startup */
+uint8_t *rom_image_ptr;
+
+#else
+
+/* Default to a copy of the ZX ROM (or whatever is in cycle roms slot 0). */
+uint8_t current_rom_index = 0;
+uint8_t *rom_image_ptr = cycle_roms[ 0 ].rom_data;
+
+#endif
+
+/* A switcher banner image. A permuted image is always a full 16K */
+#if PERMUTED_ROM_IMAGES
+#define SWITCHER_BANNER_SIZE  16384
+#else
+#define SWITCHER_BANNER_SIZE  sizeof(sw_rom)
+#endif
+
+/*
+ * Make a switcher banner: the switcher ROM with the given 32 character
+ * label over its row of x's, converted for the data bus. Where the x's
+ * are is in sw_rom_label.h.
+ */
+void bake_switcher_banner( uint8_t *banner_ptr, const uint8_t *label )
+{
+  memcpy( banner_ptr, sw_rom, sw_rom_len );
+  memcpy( banner_ptr+SW_ROM_LABEL_OFFSET, label, 32 );
+  preconvert_rom( banner_ptr, sw_rom_len );
+
+#if PERMUTED_ROM_IMAGES
+  /* Pad it out to 16K before rearranging */
+  memset( banner_ptr+sw_rom_len, 0xFF, SWITCHER_BANNER_SIZE-sw_rom_len );
+  permute_rom( banner_ptr );
+#endif
+}
+
+/*
+ * The switcher ROM, ready to run, once for each ROM in the cycle. Entry i
+ * has the label from cycle_roms[i] in it, which names the ROM after
+ * that one. With PRECONVERTED_ROMS they come from the build, see
+ * board/convert_roms.pl; otherwise bake_switcher_banners() makes them at
+ * startup. Either way the button just picks one. The library makes its
+ * banner at switch time instead, see label_library_banner().
+ */
+#if !PRECONVERTED_ROMS && !ROM_LIBRARY
+
+uint8_t switcher_banner_images[ count_of(cycle_roms) ][ SWITCHER_BANNER_SIZE ];
+
+void bake_switcher_banners( void )
+{
+  uint8_t rom_index;
+  for( rom_index = 0; rom_index < num_cycle_roms; rom_index++ )
+  {
+    bake_switcher_banner( switcher_banner_images[ rom_index ], cycle_roms[ rom_index ].rom_switcher_label );
+  }
+}
+
+#endif
+
+#else
+
+uint8_t *rom_image_ptr = __ROMs_48_original_rom;
+
+#endif
+
+
+#if PAGING_TRAPS
+
+/*
+ * Paging traps. A trap is a ROM address which, when the Z80 fetches an
+ * opcode from it, makes something happen: usually a different image
+ * being served. Which addresses do what is data, a paging_trap_set_t,
+ * loaded into a table at startup by load_paging_traps(). The serving loop
+ * looks up every opcode fetch in paging_trap_table, so it's one load
+ * however many traps there are.
+ *
+ * Each trap names an action, 1 to 255. The action's page_in image, if
+ * there is one, becomes the image served. If the action is this_fetch
+ * the fetch that hit the trap gets its byte from the new image: the loop
+ * puts that byte out straight after the first one, well before the Z80
+ * samples the bus at the end of T2. Otherwise the new image starts with
+ * the next read. Every time an action's trap is hit
+ * paging_trap_hits[action] goes up, which is how a trap raises an event
+ * for core1.
+ */
+typedef struct
+{
+  uint8_t *page_in;
+  bool     this_fetch;
+} paging_action_t;
+
+typedef struct
+{
+  uint16_t z80_address;
+  uint8_t  action;
+} paging_trap_t;
+
+typedef struct
+{
+  const paging_action_t *actions;    /* Indexed by action, entry 0 isn't used */
+  const paging_trap_t   *traps;
+  uint32_t               num_traps;
+} paging_trap_set_t;
+
+/* The action for each offset into the image, 0 for none */
+uint8_t paging_trap_table[ 16384 ];
+
+const paging_action_t *paging_actions;
+
+volatile uint32_t paging_trap_hits[ 256 ];
+
+/*
+ * The Interface One. Its ROM is paged in by opcode fetches from 0x0008
+ * (the error restart, which is how the extra BASIC commands get in) and
+ * 0x1708 (closing a stream the Spectrum ROM doesn't know about). Those
+ * fetches get the IF1 ROM's opcode. It's paged out after the opcode
+ * fetch from 0x0700, which is the IF1 ROM's.
+ *
+ * The IF1 ROM is 8K, and it only replaces the bottom 8K of the Spectrum's
+ * ROM. if1_paged_image is the two put together, see build_if1_paged_image().
+ */
+enum { IF1_PAGE_IN = 1, IF1_PAGE_OUT };
+
+uint8_t if1_paged_image[ 16384 ];
+
+const paging_action_t if1_paging_actions[] =
+{
+  [IF1_PAGE_IN]  = { if1_paged_image,        true  },
+  [IF1_PAGE_OUT] = { __ROMs_48_original_rom, false },
+};
+
+const paging_trap_t if1_paging_traps[] =
+{
+  { 0x0008, IF1_PAGE_IN  },
+  { 0x1708, IF1_PAGE_IN  },
+  { 0x0700, IF1_PAGE_OUT },
+};
+
+const paging_trap_set_t if1_trap_set = { if1_paging_actions, if1_paging_traps, count_of(if1_paging_traps) };
+
+/*
+ * The IF1 ROM's 8K with the top 8K of the base ROM above it. Both images
+ * are in the same layout, so it's just which one each offset comes from;
+ * with PERMUTED_ROM_IMAGES A13 is wherever the packing put it.
+ */
+void build_if1_paged_image( const uint8_t *if1_image_ptr, const uint8_t *base_image_ptr )
+{
+  uint16_t a13_offset_bit = image_offset_for_z80_address( 0x2000 );
+  uint32_t offset;
+
+  for( offset=0; offset<16384; offset++ )
+  {
+    if( offset & a13_offset_bit )
+      if1_paged_image[ offset ] = base_image_ptr[ offset ];
+    else
+      if1_paged_image[ offset ] = if1_image_ptr[ offset ];
+  }
+}
+
+/* Fill the table from a trap set. With PERMUTED_ROM_IMAGES that's by packed address */
+void load_paging_traps( const paging_trap_set_t *trap_set )
+{
+  uint32_t i;
+
+  memset( paging_trap_table, 0, sizeof(paging_trap_table) );
+
+  for( i=0; i<trap_set->num_traps; i++ )
+  {
+    paging_trap_table[ image_offset_for_z80_address( trap_set->traps[i].z80_address ) ] = trap_set->traps[i].action;
+  }
+
+  paging_actions = trap_set->actions;
+}
+
+#endif
+
+
+#if SERVE_FROM_COPY
+
+/*
+ * The copy of the image being served.
+ *
+ * The PIO/DMA engine can't use the indirection table, the DMA can only
+ * do one lookup. So for that engine this is always in the permuted
+ * layout, where the packed address the PIO program produces is the offset
+ * of the byte wanted. The buffer must be 16K aligned because the PIO
+ * program puts the buffer's top 18 address bits above the 14 address bus
+ * bits.
+ */
+uint8_t serving_image[ 16384 ] __attribute__((aligned(16384))) SERVING_IMAGE_PLACEMENT;
+
+#endif
+
+
+#if SERVING_ENGINE == SERVE_CPU_ASM
+
+/* In serve_rom_asm.S. Serves ROM reads until core1 sends a new image */
+void serve_rom_reads_asm( uint8_t *image_ptr );
+
+#endif
+
+
+#if SERVING_ENGINE == SERVE_PIO_DMA
+
+/*
+ * Set up the two state machines and the two DMA channels. See the PIO
+ * source for how it fits together. Once this returns ROM reads are
+ * handled without the CPU.
+ */
+void start_pio_dma_engine( void )
+{
+  PIO  serve_pio    = pio0;
+  uint address_sm   = pio_claim_unused_sm( serve_pio, true );
+  uint data_sm      = pio_claim_unused_sm( serve_pio, true );
+  int  address_chan = dma_claim_unused_channel( true );
+  int  data_chan    = dma_claim_unused_channel( true );
+
+  uint address_offset = pio_add_program( serve_pio, &rom_address_program );
+  uint data_offset    = pio_add_program( serve_pio, &rom_data_program );
+
+  rom_address_program_init( serve_pio, address_sm, address_offset, ROM_ACCESS_GP );
+  rom_data_program_init( serve_pio, data_sm, data_offset, D0_GP );
+
+  /* DMA gets priority over the CPU on the bus, the CPU isn't doing anything important */
+  bus_ctrl_hw->priority = BUSCTRL_BUS_PRIORITY_DMA_W_BITS | BUSCTRL_BUS_PRIORITY_DMA_R_BITS;
+
+  /*
+   * Data channel, one byte from wherever the address channel points it
+   * into the data SM's TX FIFO. Then kick the address channel again, which
+   * rearms it for the next ROM read.
+   */
+  dma_channel_config data_config = dma_channel_get_default_config( data_chan );
+  channel_config_set_transfer_data_size( &data_config, DMA_SIZE_8 );
+  channel_config_set_read_increment( &data_config, false );
+  channel_config_set_write_increment( &data_config, false );
+  channel_config_set_dreq( &data_config, pio_get_dreq( serve_pio, data_sm, true ) );
+  channel_config_set_chain_to( &data_config, address_chan );
+  channel_config_set_high_priority( &data_config, true );
+  dma_channel_configure( data_chan, &data_config,
+			 &serve_pio->txf[data_sm],
+			 serving_image,
+			 1,
+			 false );
+
+  /*
+   * Address channel, one word from the address SM's RX FIFO into the
+   * data channel's read address trigger register. That starts the data
+   * channel.
+   */
+  dma_channel_config address_config = dma_channel_get_default_config( address_chan );
+  channel_config_set_transfer_data_size( &address_config, DMA_SIZE_32 );
+  channel_config_set_read_increment( &address_config, false );
+  channel_config_set_write_increment( &address_config, false );
+  channel_config_set_dreq( &address_config, pio_get_dreq( serve_pio, address_sm, false ) );
+  channel_config_set_high_priority( &address_config, true );
+  dma_channel_configure( address_chan, &address_config,
+			 &dma_hw->ch[data_chan].al3_read_addr_trig,
+			 &serve_pio->rxf[address_sm],
+			 1,
+			 true );
+
+  /* The address SM pulls the top bits of the buffer address once at the start */
+  pio_sm_put( serve_pio, address_sm, ((uint32_t)serving_image) >> 14 );
+
+  pio_sm_set_enabled( serve_pio, data_sm,    true );
+  pio_sm_set_enabled( serve_pio, address_sm, true );
+}
+
+#endif
+
+
+#if SERVING_ENGINE == SERVE_PIO_CPU
+
+/*
+ * The snapshot SM. It's fixed rather than claimed so the serving loop's
+ * FIFO accesses compile down to constant addresses.
+ */
+#define SNAPSHOT_PIO  pio0
+#define SNAPSHOT_SM   0
+
+/*
+ * Snapshots which came through with ROM_ACCESS high, i.e. a glitch on
+ * ROM_ACCESS shorter than the input synchroniser's delay. The serving
+ * loop drops them. Read it with the debugger.
+ */
+volatile uint32_t glitch_snapshots = 0;
+
+#if ROM_ACCESS_FILTER_SAMPLES
+
+/*
+ * What the glitch filter adds between ROM_ACCESS going low and the
+ * snapshot reaching the CPU, in ns at the clock the SM was started at.
+ * That's the extra over the unfiltered snapshot, ROM_ACCESS_FILTER_CYCLES
+ * less ROM_ACCESS_SNAPSHOT_CYCLES, 7N+6. Read it with the debugger.
+ */
+volatile uint32_t rom_access_filter_latency_ns;
+
+#endif
+
+void start_pio_snapshot( void )
+{
+  pio_sm_claim( SNAPSHOT_PIO, SNAPSHOT_SM );
+
+#if ROM_ACCESS_FILTER_SAMPLES
+
+  uint offset = pio_add_program( SNAPSHOT_PIO, &rom_access_filtered_program );
+  rom_access_filtered_program_init( SNAPSHOT_PIO, SNAPSHOT_SM, offset, ROM_ACCESS_GP, ROM_ACCESS_FILTER_SAMPLES );
+
+  rom_access_filter_latency_ns = (uint32_t)( (uint64_t)(ROM_ACCESS_FILTER_CYCLES - ROM_ACCESS_SNAPSHOT_CYCLES) * 1000000000ull / clock_get_hz( clk_sys ) );
+
+#else
+
+  uint offset = pio_add_program( SNAPSHOT_PIO, &rom_access_snapshot_program );
+  rom_access_snapshot_program_init( SNAPSHOT_PIO, SNAPSHOT_SM, offset );
+
+#endif
+
+  pio_sm_set_enabled( SNAPSHOT_PIO, SNAPSHOT_SM, true );
+}
+
+#endif
+
+
+/*
+ * Make the given image the one to be served, and return the pointer the
+ * serving loop should use. For the CPU loop that's just the image. When
+ * serving from a copy the image is copied into the serving buffer; for the
+ * PIO/DMA engine it's permuted on the way if it isn't already. That takes
+ * up to a few milliseconds, so it's only done with the Z80 held in reset.
+ */
+uint8_t *select_rom_image( uint8_t *image_ptr, uint32_t length )
+{
+#if SERVE_FROM_COPY
+
+#if PERMUTED_ROM_IMAGES || (SERVING_ENGINE != SERVE_PIO_DMA)
+
+  /* Already in the layout the engine wants. A library image may already be there */
+  if( image_ptr != serving_image )
+    memcpy( serving_image, image_ptr, length );
+
+#else
+
+  uint32_t i;
+  for( i=0; i<16384; i++ )
+  {
+    uint8_t value = (i < length) ? *(image_ptr+i) : 0xFF;
+
+    serving_image[ pack_z80_address( i ) ] = value;
+  }
+
+#endif
+
+  return serving_image;
+
+#else
+
+  return image_ptr;
+
+#endif
+}
+
+
+#if M1_AWARE_SERVING
+
+/*
+ * Counters for the non-M1 path, and a trace of the last READ_TRACE_LENGTH
+ * addresses read there. Read them with the debugger. With
+ * PERMUTED_ROM_IMAGES the trace holds packed GPIO patterns, not Z80
+ * addresses; pack_z80_address() goes the other way.
+ */
+volatile uint32_t non_m1_reads = 0;
+volatile uint16_t read_trace[ READ_TRACE_LENGTH ];
+volatile uint32_t read_trace_head = 0;
+
+#endif
+
+
+#if (SERVING_ENGINE == SERVE_CPU_SPECULATIVE) && SPECULATION_STATS
+
+/* ROM reads where the speculated byte was, or wasn't, already in place */
+volatile uint32_t speculation_hits   = 0;
+volatile uint32_t speculation_misses = 0;
+
+#endif
+
+
+#if CLOCK_CALIBRATION
+
+/*
+ * Numbers for the calibration. What's left of the M1 budget after the
+ * bus delay (see M1_BUDGET_NS), less the margin, is what the Pico has to
+ * get the byte out.
+ */
+#define CALIBRATION_SPINS  1000
+
+/* Clocks the calibration can choose, lowest first */
+const uint32_t calibration_clocks_khz[] = { 125000, 133000, 140000, 150000, 175000, 200000 };
+
+/* The chosen clock and the cycle count it was chosen from. Read them with the debugger */
+volatile uint32_t calibrated_sys_khz      = 0;
+volatile uint32_t calibrated_worst_cycles = 0;
+
+/* Volatile so the compiler can't hoist the lookup out of the timed region */
+volatile uint32_t calibration_gpios;
+
+/* The byte on the data bus while the calibration runs */
+uint8_t calibration_dbus;
+
+/* SysTick counts down, and it's 24 bits */
+#define SYSTICK_ELAPSED(start,end)  ( ((start) - (end)) & 0x00FFFFFF )
+
+/*
+ * Once round the engine's spin loop, the same tests as the real thing.
+ * True while there's nothing to do.
+ */
+static __force_inline bool calibration_spin_idle( void )
+{
+#if SERVING_ENGINE == SERVE_PIO_CPU
+
+  return pio_sm_is_rx_fifo_empty( SNAPSHOT_PIO, SNAPSHOT_SM ) && !multicore_fifo_rvalid();
+
+#elif SERVING_ENGINE == SERVE_CPU_SPECULATIVE
+
+  uint32_t gpios_state = gpio_get_all();
+
+  calibration_dbus = put_data_bus( *(rom_image_ptr+rom_offset_for_gpios( gpios_state )), calibration_dbus );
+  return (gpios_state & ROM_ACCESS_BIT_MASK) && !multicore_fifo_rvalid();
+
+#else
+
+  return (gpio_get_all() & ROM_ACCESS_BIT_MASK) && !multicore_fifo_rvalid();
+
+#endif
+}
+
+/*
+ * Time the serving loop's critical path in CPU cycles, with SysTick
+ * running from the processor clock. Only call this with the Z80 held in
+ * reset: ROM_ACCESS is high so the spin never finds a ROM read, and
+ * nothing is looking at the data bus.
+ *
+ * The worst case is a ROM_ACCESS edge which arrives just after the spin
+ * loop sampled the GPIOs. That's the input synchroniser, one whole time
+ * round the spin loop, then the lookup and the data bus write. The spin
+ * loop is timed over CALIBRATION_SPINS goes; the loop counter adds a
+ * little, which is on the safe side. The lookup and write are timed for
+ * each of the 16384 addresses, twice, and the slowest of the second pass
+ * is taken; the first pass is to get the code and tables into the XIP
+ * cache. The GPIO state comes from RAM instead of the SIO, another cycle
+ * on the safe side. For the speculative engine the byte goes out inside
+ * the spin loop so there's nothing after it.
+ */
+uint32_t measure_serving_cycles( void )
+{
+  uint32_t start, end, overhead, spin, path, cycles, i, pass;
+
+  calibration_dbus = data_bus_state();
+
+  systick_hw->csr = 0;
+  systick_hw->rvr = 0x00FFFFFF;
+  systick_hw->cvr = 0;
+  systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
+
+  /* What two back to back SysTick reads cost */
+  start = systick_hw->cvr;
+  end   = systick_hw->cvr;
+  overhead = SYSTICK_ELAPSED( start, end );
+
+  start = systick_hw->cvr;
+  for( i=CALIBRATION_SPINS; i && calibration_spin_idle(); i-- );
+  end = systick_hw->cvr;
+  spin = (SYSTICK_ELAPSED( start, end ) - overhead + CALIBRATION_SPINS - 1) / CALIBRATION_SPINS;
+
+  path = 0;
+
+#if SERVING_ENGINE != SERVE_CPU_SPECULATIVE
+
+  for( pass=0; pass<2; pass++ )
+  {
+    for( i=0; i<16384; i++ )
+    {
+      calibration_gpios = create_gpios_for_address( i );
+
+      start = systick_hw->cvr;
+      calibration_dbus = put_data_bus( *(rom_image_ptr+rom_offset_for_gpios( calibration_gpios )), calibration_dbus );
+      end = systick_hw->cvr;
+
+      cycles = SYSTICK_ELAPSED( start, end ) - overhead;
+      if( pass && (cycles > path) )
+	path = cycles;
+    }
+  }
+
+#endif
+
+  systick_hw->csr = 0;
+
+#if SERVING_ENGINE == SERVE_PIO_CPU
+  /* Input synchroniser, then the PIO's wait, in and push */
+  return 2 + 3 + spin + path;
+#else
+  /* Input synchroniser */
+  return 2 + spin + path;
+#endif
+}
+
+/*
+ * Pick the lowest clock in calibration_clocks_khz which does the worst
+ * case in the time available. If none of them does, the fastest is used.
+ * Cycles per nanosecond is GHz, so cycles*1,000,000/ns is in kHz.
+ *
+ * The measurement is done at whatever the clock is at the time, which is
+ * the stock 125MHz. Cycle counts don't change with the clock except for
+ * flash fetches, and the first pass of the measurement takes those out.
+ *
+ * With CALIBRATED_SYS_KHZ set that clock is used as it is, provided the
+ * PLL can make it. If it can't the measurement is done after all.
+ */
+uint32_t calibrate_sys_clock( void )
+{
+  const uint32_t usable_ns = (M1_BUDGET_NS - BUS_DELAY_NS) * (100 - CALIBRATION_MARGIN_PERCENT) / 100;
+  uint32_t needed_khz;
+  uint     vco, postdiv1, postdiv2;
+  uint     i;
+
+#if CALIBRATED_SYS_KHZ
+  if( check_sys_clock_khz( CALIBRATED_SYS_KHZ, &vco, &postdiv1, &postdiv2 ) )
+  {
+    calibrated_sys_khz = CALIBRATED_SYS_KHZ;
+    return calibrated_sys_khz;
+  }
+#endif
+
+  calibrated_worst_cycles = measure_serving_cycles();
+  needed_khz = (calibrated_worst_cycles * 1000000 + usable_ns - 1) / usable_ns;
+
+  for( i=0; i<count_of(calibration_clocks_khz); i++ )
+  {
+    calibrated_sys_khz = calibration_clocks_khz[i];
+
+    if( (calibrated_sys_khz >= needed_khz) && check_sys_clock_khz( calibrated_sys_khz, &vco, &postdiv1, &postdiv2 ) )
+      break;
+  }
+
+  return calibrated_sys_khz;
+}
+
+#endif
+
+
+/*
+ * Microseconds from power up to the Z80 first being let out of reset.
+ * Read it with the debugger; it's the figure to watch when changing
+ * what's done at startup.
+ */
+volatile uint32_t z80_released_at_us = 0;
+
+/*
+ * This is called by an alarm function. It lets the Z80 run by pulling the
+ * Pico's controlling GPIO low
+ */
+int64_t start_z80_alarm_func( alarm_id_t id, void *user_data )
+{
+  gpio_put( PICO_RESET_Z80_GP, 0 );
+
+  if( z80_released_at_us == 0 )
+    z80_released_at_us = time_us_32();
+
+  return 0;
+}
+
+/*
+ * Microseconds from power up to the Z80's first ROM read, which is the
+ * first byte served. Zero if it didn't come within a tenth of a second of
+ * the Z80 being released.
+ */
+volatile uint32_t first_rom_access_at_us = 0;
+
+/* Called on core1 at startup, waits for the Z80 to be released then for its first ROM read */
+void time_first_rom_access( void )
+{
+  while( z80_released_at_us == 0 );
+
+  /* ROM_ACCESS is active low */
+  while( gpio_get( ROM_ACCESS_GP ) )
+  {
+    if( (time_us_32() - z80_released_at_us) > 100000 )
+      return;
+  }
+  first_rom_access_at_us = time_us_32();
+}
+
+/* Blip LED to show we're running */
+void blip_led( void )
+{
+#if LED_IN_USE
+  gpio_init(LED_PIN);
+  gpio_set_dir(LED_PIN, GPIO_OUT);
+  int signal;
+  for( signal=0; signal<2; signal++ )
+  {
+    gpio_put(LED_PIN, 1);
+    busy_wait_us_32(250000);
+    gpio_put(LED_PIN, 0);
+    busy_wait_us_32(250000);
+  }
+  gpio_put(LED_PIN, 0);
+#endif
+}
+
+
+#if !ZX_IF1_VERSION
+
+/*
+ * The image core1 last sent and its length, and the one the serving
+ * core is serving. They differ until the serving core picks up a new
+ * image.
+ */
+uint8_t *sent_image_ptr;
+uint32_t sent_image_length;
+uint8_t * volatile served_image_ptr;
+
+/*
+ * Select an image and send the pointer to it to the serving core. The
+ * serving loop picks it up from the SIO FIFO next time it's waiting for
+ * a ROM access, so this must only be called with the Z80 held in reset
+ * (or with an image the Z80 can be switched to mid-run, see HOT_SWAP).
+ */
+void send_rom_image( uint8_t *image_ptr, uint32_t length )
+{
+  sent_image_ptr    = select_rom_image( image_ptr, length );
+  sent_image_length = length;
+  multicore_fifo_push_blocking( (uint32_t)sent_image_ptr );
+}
+
+#if ROM_LIBRARY
+
+/*
+ * The ROM library. rom_library is generated from rom_library.txt by
+ * board/build_rom_library.pl and stays in flash, each image in a 16K slot
+ * already converted (and permuted) the way roms_converted.h's are. On a
+ * switch, with the Z80 held in reset, a DMA channel copies the chosen
+ * image into one fixed SRAM buffer and that's what gets served. So the
+ * serving path never touches flash, however many ROMs are in the library.
+ *
+ * The copy reads flash through the XIP no-allocate alias, so 16K of ROM
+ * image going past doesn't throw everything else out of the XIP cache.
+ * Each copy is timed, read library_copy_us with the debugger.
+ *
+ * When serving from a copy the library images are already in the layout
+ * the serving buffer wants, so they're copied straight into it.
+ */
+#if SERVE_FROM_COPY && (PERMUTED_ROM_IMAGES || (SERVING_ENGINE != SERVE_PIO_DMA))
+#define LIBRARY_IMAGE  serving_image
+#else
+uint8_t library_image[ 16384 ];
+#define LIBRARY_IMAGE  library_image
+#endif
+
+/* Entry 0 is the ROM the Spectrum powers up with, see rom_library.txt */
+uint32_t current_library_index = 0;
+
+int library_dma_channel;
+
+/* Microseconds for the last copy and the slowest, and how many there's been */
+volatile uint32_t library_copy_us     = 0;
+volatile uint32_t library_copy_max_us = 0;
+volatile uint32_t library_copies      = 0;
+
+void start_rom_library( void )
+{
+  library_dma_channel = dma_claim_unused_channel( true );
+}
+
+uint32_t next_library_index( void )
+{
+  return (current_library_index + 1) % ROM_LIBRARY_ENTRIES;
+}
+
+/*
+ * DMA a library image out of flash into image_ptr, 16K, and time it.
+ */
+void copy_library_image( uint32_t library_index, uint8_t *image_ptr )
+{
+  const uint8_t *flash_ptr = rom_library + rom_library_index[ library_index ].offset;
+  uint32_t       started_us;
+
+  dma_channel_config config = dma_channel_get_default_config( library_dma_channel );
+  channel_config_set_transfer_data_size( &config, DMA_SIZE_32 );
+  channel_config_set_read_increment( &config, true );
+  channel_config_set_write_increment( &config, true );
+
+  started_us = time_us_32();
+
+  dma_channel_configure( library_dma_channel, &config,
+			 image_ptr,
+			 flash_ptr - XIP_BASE + XIP_NOCACHE_NOALLOC_BASE,
+			 16384 / sizeof(uint32_t),
+			 true );
+  dma_channel_wait_for_finish_blocking( library_dma_channel );
+
+  library_copy_us = time_us_32() - started_us;
+  if( library_copy_us > library_copy_max_us )
+    library_copy_max_us = library_copy_us;
+  library_copies++;
+}
+
+/*
+ * Copy a library image into the serving buffer and return it. That's the
+ * buffer being served, so the Z80 must be held in reset.
+ */
+uint8_t *stage_library_image( uint32_t library_index )
+{
+  copy_library_image( library_index, LIBRARY_IMAGE );
+
+  return LIBRARY_IMAGE;
+}
+
+#if SWITCH_BANNER_MS
+
+/*
+ * There are no prebuilt banners for the library, one for each entry
+ * would take as much RAM as the ROMs did. The banner is made from the
+ * switcher ROM each time. That's a few milliseconds when it's permuted,
+ * and the Z80 is about to be held in reset anyway.
+ */
+uint8_t library_banner_image[ SWITCHER_BANNER_SIZE ];
+
+uint8_t *label_library_banner( uint32_t library_index )
+{
+  bake_switcher_banner( library_banner_image, (const uint8_t *)rom_library_index[ library_index ].label );
+
+  return library_banner_image;
+}
+
+#endif
+
+#endif
+
+/*
+ * ROM switching. When the user clicks the button the switcher ROM is run,
+ * which presents a banner saying which ROM is about to appear. After
+ * SWITCH_BANNER_MS the next ROM in the cycle is started. Each start holds
+ * the Z80 in reset for SWITCH_RESET_US and until the serving core has
+ * picked up the new image. The LED is lit from the button press until
+ * the new ROM is running.
+ *
+ * This is a state machine which core1's loop runs every time round, see
+ * run_rom_switch(), so nothing waits on a timer.
+ */
+typedef enum
+{
+  SWITCH_IDLE,           /* A ROM is running, waiting for the button */
+  SWITCH_BANNER_RESET,   /* Z80 in reset, switcher ROM going in */
+  SWITCH_BANNER,         /* Switcher ROM running, showing the banner */
+  SWITCH_TARGET_RESET,   /* Z80 in reset, next ROM going in */
+} switch_state_t;
+
+switch_state_t switch_state            = SWITCH_IDLE;
+uint32_t       switch_state_entered_us = 0;
+uint32_t       switch_started_us       = 0;
+
+/* The button has to be let go, for SWITCH_DEBOUNCE_US, between presses */
+bool           button_armed            = false;
+uint32_t       button_up_since_us      = 0;
+
+/* Button press to the new ROM starting, in microseconds. Read it with the debugger */
+volatile uint32_t last_switch_us = 0;
+
+/* Hold the Z80 in reset and send the serving core the image to restart it with */
+void restart_z80_with( uint8_t *image_ptr, uint32_t length, switch_state_t next_state )
+{
+  gpio_put( PICO_RESET_Z80_GP, 1 );
+
+  send_rom_image( image_ptr, length );
+
+  switch_state            = next_state;
+  switch_state_entered_us = time_us_32();
+}
+
+/* The Z80's been in reset long enough, and the serving core has the new image */
+bool z80_ready_to_release( void )
+{
+  return ( (time_us_32() - switch_state_entered_us) >= SWITCH_RESET_US )
+         &&
+         ( served_image_ptr == sent_image_ptr );
+}
+
+/* Move on to the next ROM in the cycle, or in the library */
+void restart_z80_with_next_rom( void )
+{
+#if ROM_LIBRARY
+
+  current_library_index = next_library_index();
+
+  /*
+   * The copy goes into the buffer being served, so the Z80 has to be in
+   * reset before it starts. That's restart_z80_with() done by hand, it
+   * would only stage the image after the reset.
+   */
+  gpio_put( PICO_RESET_Z80_GP, 1 );
+
+  send_rom_image( stage_library_image( current_library_index ), 16384 );
+
+  switch_state            = SWITCH_TARGET_RESET;
+  switch_state_entered_us = time_us_32();
+
+#else
+
+  if( ++current_rom_index == num_cycle_roms ) current_rom_index=0;
+
+  restart_z80_with( cycle_roms[ current_rom_index ].rom_data, cycle_roms[ current_rom_index ].rom_size,
+		    SWITCH_TARGET_RESET );
+
+#endif
+}
+
+/* Called every time round core1's loop */
+void run_rom_switch( void )
+{
+  uint32_t now_us  = time_us_32();
+  bool     pressed = gpio_get( PICO_USER_INPUT_GP );
+
+  /* The switch is a bit noisy */
+  if( pressed )
+    button_up_since_us = now_us;
+  else if( (now_us - button_up_since_us) >= SWITCH_DEBOUNCE_US )
+    button_armed = true;
+
+  switch( switch_state )
+  {
+  case SWITCH_IDLE:
+    if( pressed && button_armed )
+    {
+      button_armed      = false;
+      switch_started_us = now_us;
+#if LED_IN_USE
+      gpio_put(LED_PIN, 1);
+#endif
+
+#if SWITCH_BANNER_MS && ROM_LIBRARY
+      restart_z80_with( label_library_banner( next_library_index() ), sizeof(library_banner_image),
+			SWITCH_BANNER_RESET );
+#elif SWITCH_BANNER_MS
+      restart_z80_with( switcher_banner_images[ current_rom_index ], sizeof(switcher_banner_images[0]),
+			SWITCH_BANNER_RESET );
+#else
+      restart_z80_with_next_rom();
+#endif
+    }
+    break;
+
+  case SWITCH_BANNER_RESET:
+    if( z80_ready_to_release() )
+    {
+      gpio_put( PICO_RESET_Z80_GP, 0 );
+
+      switch_state            = SWITCH_BANNER;
+      switch_state_entered_us = now_us;
+    }
+    break;
+
+  case SWITCH_BANNER:
+    if( (now_us - switch_state_entered_us) >= (SWITCH_BANNER_MS * 1000) )
+      restart_z80_with_next_rom();
+    break;
+
+  case SWITCH_TARGET_RESET:
+    if( z80_ready_to_release() )
+    {
+      gpio_put( PICO_RESET_Z80_GP, 0 );
+#if LED_IN_USE
+      gpio_put(LED_PIN, 0);
+#endif
+
+      last_switch_us = time_us_32() - switch_started_us;
+      switch_state   = SWITCH_IDLE;
+    }
+    break;
+  }
+}
+
+
+#if HOT_SWAP
+
+/*
+ * A hot swap request, written with the debugger while the Spectrum runs.
+ * Fill in the rest, then set pending to 1. Core1 clears pending when the
+ * serving core has picked up the new image. For example, in gdb:
+ *
+ *   restore patch.bin binary &hot_swap_request.bytes
+ *   set var hot_swap_request.z80_address = 0x0066
+ *   set var hot_swap_request.length = 12
+ *   set var hot_swap_request.pending = 1
+ *
+ * A length of 0 switches to cycle_roms[ rom_index ] instead, or with
+ * ROM_LIBRARY to library entry rom_index. The bytes
+ * are as they are in the ROM file; they're converted for the data bus
+ * on the way in. Check status once pending is back to 0: a request for
+ * a ROM which doesn't exist, or a patch which doesn't fit in the 16K,
+ * is refused and nothing changes.
+ */
+typedef enum
+{
+  HOT_SWAP_DONE,
+  HOT_SWAP_BAD_ROM_INDEX,
+  HOT_SWAP_BAD_RANGE,
+} hot_swap_status_t;
+
+typedef struct
+{
+  uint32_t pending;
+  uint32_t rom_index;
+  uint32_t z80_address;
+  uint32_t length;
+  uint8_t  bytes[ HOT_SWAP_MAX_PATCH ];
+
+  /* Filled in by core1. Building the staged image, and waiting for the serving core to take it */
+  uint32_t stage_us;
+  uint32_t swap_us;
+  hot_swap_status_t status;
+} hot_swap_request_t;
+
+volatile hot_swap_request_t hot_swap_request;
+
+/*
+ * Patched images are built in whichever of these isn't being served.
+ * A permuted image is always a full 16K, and so is a patched one.
+ */
+uint8_t hot_swap_buffers[ 2 ][ 16384 ];
+
+/*
+ * Called from core1's loop, does nothing unless a request is pending.
+ * The Z80 isn't reset: the serving core switches images at the top of
+ * its loop, when it's between ROM reads, and the Spectrum carries on
+ * from wherever it was with the new bytes.
+ */
+void service_hot_swap_request( void )
+{
+  uint32_t started_us, staged_us;
+  uint32_t i;
+
+  /* Not while a ROM switch is under way */
+  if( !hot_swap_request.pending || (switch_state != SWITCH_IDLE) )
+    return;
+
+  /*
+   * The serving core has to be off the last image before either buffer
+   * can be touched. It picks images up within a ROM read or so.
+   */
+  while( served_image_ptr != sent_image_ptr );
+
+  started_us = time_us_32();
+
+  uint8_t *staging_ptr = (sent_image_ptr == hot_swap_buffers[0]) ? hot_swap_buffers[1] : hot_swap_buffers[0];
+
+  if( hot_swap_request.length == 0 )
+  {
+#if ROM_LIBRARY
+    if( hot_swap_request.rom_index >= ROM_LIBRARY_ENTRIES )
+#else
+    if( hot_swap_request.rom_index >= num_cycle_roms )
+#endif
+    {
+      hot_swap_request.status  = HOT_SWAP_BAD_ROM_INDEX;
+      hot_swap_request.pending = 0;
+      return;
+    }
+
+#if ROM_LIBRARY
+    /* The library's buffer is the one being served, the new image goes in a hot swap buffer */
+    current_library_index = hot_swap_request.rom_index;
+    copy_library_image( current_library_index, staging_ptr );
+    send_rom_image( staging_ptr, 16384 );
+#else
+    current_rom_index = hot_swap_request.rom_index;
+    send_rom_image( cycle_roms[ current_rom_index ].rom_data, cycle_roms[ current_rom_index ].rom_size );
+#endif
+  }
+  else
+  {
+    /* Written so it can't wrap, z80_address is whatever the debugger put there */
+    if( (hot_swap_request.z80_address >= 16384) ||
+	(hot_swap_request.length > 16384 - hot_swap_request.z80_address) ||
+	(hot_swap_request.length > HOT_SWAP_MAX_PATCH) )
+    {
+      hot_swap_request.status  = HOT_SWAP_BAD_RANGE;
+      hot_swap_request.pending = 0;
+      return;
+    }
+
+    memcpy( staging_ptr, sent_image_ptr, sent_image_length );
+    memset( staging_ptr+sent_image_length, DATA_BYTE_TO_GPIOS( 0xFF ), 16384-sent_image_length );
+
+    for( i=0; i<hot_swap_request.length; i++ )
+    {
+      uint8_t rom_byte = hot_swap_request.bytes[i];
+
+      staging_ptr[ image_offset_for_z80_address( hot_swap_request.z80_address+i ) ] = DATA_BYTE_TO_GPIOS( rom_byte );
+    }
+
+    send_rom_image( staging_ptr, 16384 );
+  }
+
+  staged_us = time_us_32();
+  while( served_image_ptr != sent_image_ptr );
+
+  hot_swap_request.stage_us = staged_us - started_us;
+  hot_swap_request.swap_us  = time_us_32() - staged_us;
+  hot_swap_request.status   = HOT_SWAP_DONE;
+  hot_swap_request.pending  = 0;
+}
+
+#endif
+
+#endif
+
+
+#if DEADLINE_MONITOR
+
+/*
+ * Counters kept by the serving loop. Only core0 writes them, so core1
+ * can read them without any locking; at worst a figure is one read out
+ * of date.
+ */
+typedef struct
+{
+  uint32_t reads;          /* ROM reads served */
+  uint32_t late_reads;     /* ROM_ACCESS had gone before the byte went out */
+  uint32_t slow_reads;     /* over DEADLINE_THRESHOLD_CYCLES from seeing ROM_ACCESS to the byte going out */
+  uint32_t worst_cycles;   /* slowest seen from seeing ROM_ACCESS to the byte going out */
+} serving_counters_t;
+
+volatile serving_counters_t serving_counters;
+
+/*
+ * Core1's once a second summary of the counters. Read it with the
+ * debugger. The LED belongs to the ROM switching, so it's not used here.
+ */
+typedef struct
+{
+  uint32_t sys_khz;
+  uint32_t reads_per_second;
+  uint32_t late_reads;
+  uint32_t late_reads_last_second;
+  uint32_t slow_reads;
+  uint32_t worst_cycles;
+} serving_report_t;
+
+volatile serving_report_t serving_report;
+
+uint64_t next_report_us       = 0;
+uint32_t reads_at_last_report = 0;
+uint32_t late_at_last_report  = 0;
+
+/* Called from core1's loop, does nothing until the next report is due */
+void report_serving_counters( void )
+{
+  uint64_t now_us = get_time_us();
+  uint32_t reads, late_reads;
+
+  if( now_us < next_report_us )
+    return;
+  next_report_us = now_us + 1000000;
+
+  reads      = serving_counters.reads;
+  late_reads = serving_counters.late_reads;
+
+  serving_report.sys_khz                = clock_get_hz( clk_sys ) / 1000;
+  serving_report.reads_per_second       = reads - reads_at_last_report;
+  serving_report.late_reads             = late_reads;
+  serving_report.late_reads_last_second = late_reads - late_at_last_report;
+  serving_report.slow_reads             = serving_counters.slow_reads;
+  serving_report.worst_cycles           = serving_counters.worst_cycles;
+
+  reads_at_last_report = reads;
+  late_at_last_report  = late_reads;
+}
+
+#endif
+
+
+#if SRAM_PLACEMENT
+
+/*
+ * Core1's stack. The SDK puts it in scratch_x by default, which is where
+ * the serving loop runs from, so it's moved out into main RAM.
+ */
+uint32_t core1_stack[ 1024 ];
+
+#endif
+
+/* Set by core0 just before it goes into the serving loop */
+volatile bool serving_core_ready = false;
+
+/*
+ * ROM serving runs on core0 with all interrupts off. This core does
+ * everything else: starting the Z80, watching the user button and
+ * moving between ROMs. New images go to the serving core through
+ * the SIO FIFO, see send_rom_image().
+ */
+void core1_main( void )
+{
+  /* All interrupts off on this core except the timers */
+  irq_set_mask_enabled( 0xFFFFFFFF, 0 );
+  irq_set_mask_enabled( 0x0000000F, 1 );
+
+#if FAST_BOOT
+
+  /*
+   * The serving core is a handful of instructions from its loop once it
+   * says it's ready, and the Z80 takes longer than that to get from reset
+   * to its first read. So let it go straight away.
+   */
+  while( !serving_core_ready );
+  start_z80_alarm_func( 0, NULL );
+  time_first_rom_access();
+
+#if !ZX_IF1_VERSION
+  /* Set up Pico's user input pin, pull to zero, switch will send it to 1 */
+  gpio_init( PICO_USER_INPUT_GP ); gpio_set_dir( PICO_USER_INPUT_GP, GPIO_IN );
+  gpio_pull_down( PICO_USER_INPUT_GP );
+#endif
+
+  blip_led();
+
+#else
+
+  /*
+   * Ready to go, give it a few milliseconds for the serving core to get
+   * into its loop, then let the Z80 start
+   */
+  add_alarm_in_ms( 5, start_z80_alarm_func, NULL, 0 );
+  time_first_rom_access();
+
+#endif
+
+#if !ZX_IF1_VERSION
+
+  while(1)
+  {
+    run_rom_switch();
+
+#if DEADLINE_MONITOR
+    report_serving_counters();
+#endif
+
+#if HOT_SWAP
+    service_hot_swap_request();
+#endif
+  }
+
+#else
+
+  while(1)
+  {
+#if DEADLINE_MONITOR
+    report_serving_counters();
+#endif
+    sleep_ms(1);
+  }
+
+#endif
+}
+
+
+/*
+ * The serving loop. It never returns, and it runs with all interrupts off.
+ * With SRAM_PLACEMENT it runs from scratch_x, see CMakeLists.txt.
+ *
+ * Between ROM reads it watches the SIO FIFO. Core1 sends it a pointer to
+ * the image to serve whenever the ROM is switched.
+ */
+void SERVING_LOOP_PLACEMENT serve_rom_reads( void )
+{
+#if SERVING_ENGINE == SERVE_CPU_SPECULATIVE
+
+  /* The byte currently on the data bus GPIOs, and the one before it */
+  register uint8_t  rom_value = data_bus_state();
+  register uint8_t  previous_rom_value;
+  register uint16_t rom_address;
+
+#endif
+
+#if SERVING_LOOP_IN_C && (SERVING_ENGINE != SERVE_CPU_SPECULATIVE)
+
+  /* The byte currently on the data bus GPIOs */
+  register uint8_t dbus_value = data_bus_state();
+
+#endif
+
+
+  while(1)
+  {
+    register uint32_t gpios_state;
+
+#if SERVING_ENGINE == SERVE_PIO_DMA
+
+    /*
+     * ROM reads are handled entirely by the PIO and DMA. This core only
+     * has to wait for core1 to say the image has changed, and the serving
+     * buffer has already been updated by then.
+     */
+    rom_image_ptr = (uint8_t *)multicore_fifo_pop_blocking();
+    served_image_ptr = rom_image_ptr;
+    continue;
+
+#elif SERVING_ENGINE == SERVE_CPU_ASM
+
+    /*
+     * The assembly loop does the whole ROM read, including waiting for it
+     * to finish. It only comes back here when core1 has sent a new image.
+     */
+    serve_rom_reads_asm( rom_image_ptr );
+    rom_image_ptr = (uint8_t *)multicore_fifo_pop_blocking();
+    served_image_ptr = rom_image_ptr;
+    continue;
+
+#elif SERVING_ENGINE == SERVE_PIO_CPU
+
+    /*
+     * Wait for the PIO to hand over the GPIO snapshot of a ROM access.
+     * Also break out when core1 sends a new image.
+     */
+    bool image_sent = false;
+    while( 1 )
+    {
+      if( !pio_sm_is_rx_fifo_empty( SNAPSHOT_PIO, SNAPSHOT_SM ) )
+      {
+	gpios_state = pio_sm_get( SNAPSHOT_PIO, SNAPSHOT_SM );
+	break;
+      }
 
 #if !ZX_IF1_VERSION
+      if( multicore_fifo_rvalid() )
+      {
+	image_sent = true;
+	break;
+      }
+#endif
+    }
 
-/* Default to a copy of the ZX ROM (or whatever is in cycle roms slot 0). */
-uint8_t current_rom_index = 0;
-uint8_t *rom_image_ptr = cycle_roms[ 0 ].rom_data;
+    /*
+     * The state machine doesn't look at ROM_ACCESS again after seeing it
+     * go low, so a glitch shorter than the input synchroniser's delay
+     * gets snapshotted with ROM_ACCESS back high. That's not a ROM read,
+     * drop it.
+     */
+    if( !image_sent && (gpios_state & ROM_ACCESS_BIT_MASK) )
+    {
+      glitch_snapshots++;
+      continue;
+    }
 
-#else
+#elif SERVING_ENGINE == SERVE_CPU_SPECULATIVE
 
-uint8_t *rom_image_ptr = __ROMs_48_original_rom;
+    /*
+     * Keep putting the byte for whatever's on the address bus onto the data
+     * bus, until the hardware says the ROM is being accessed (or core1 sends
+     * a new image). When that happens the byte for the sampled address
+     * is already out there; if the address hasn't changed since the previous
+     * time round it was out there before ROM_ACCESS went low.
+     */
+    do
+    {
+      previous_rom_value = rom_value;
+
+      gpios_state = gpio_get_all();
+
+      rom_address = rom_offset_for_gpios( gpios_state );
 
+      rom_value = put_data_bus( *(rom_image_ptr+rom_address), previous_rom_value );
+    }
+    while( (gpios_state & ROM_ACCESS_BIT_MASK)
+#if !ZX_IF1_VERSION
+	   &&
+	   !multicore_fifo_rvalid()
 #endif
+	   );
 
+#elif !ZX_IF1_VERSION
 
-/*
- * This is called by an alarm function. It lets the Z80 run by pulling the
- * Pico's controlling GPIO low
- */
-int64_t start_z80_alarm_func( alarm_id_t id, void *user_data )
-{
-  gpio_put( PICO_RESET_Z80_GP, 0 );
-  return 0;
-}
+    /*
+     * Spin while the hardware is saying at least one of A14, A15 and MREQ is 1.
+     * ROM_ACCESS is active low - if it's 1 then the ROM is not being accessed.
+     * Also break out when core1 sends a new image.
+     */
+    while( ( (gpios_state=gpio_get_all()) & ROM_ACCESS_BIT_MASK )
+	   &&
+	   !multicore_fifo_rvalid() );
+
+#else
+
+    /*
+     * Spin while the hardware is saying at least one of A14, A15 and MREQ is 1.
+     * ROM_ACCESS is active low - if it's 1 then the ROM is not being accessed.
+     */
+    while( (gpios_state=gpio_get_all()) & ROM_ACCESS_BIT_MASK );
+
+#endif
 
 
+#if DEADLINE_THRESHOLD_CYCLES && SERVING_LOOP_IN_C
+    register uint32_t access_seen = systick_hw->cvr;
+#endif
+
 #if !ZX_IF1_VERSION
 
-/*
- * Switcher function. When the user clicks the button to move to the next ROM
- * the utility switcher ROM is loaded which presents a banner saying which
- * ROM is about to appear. That stays for a moment, then this function runs.
- * This switches that switcher ROM out and loads the next ROM in the cycle.
- */
-int64_t switcher_alarm_func( alarm_id_t id, void *user_data )
-{
-  gpio_put( PICO_RESET_Z80_GP, 1 );
+    /*
+     * Out of the spin without a ROM access, so core1 has sent a new image.
+     * That's between ROM reads, so the switch is safe even with the Z80
+     * running, which is what HOT_SWAP relies on.
+     */
+#if SERVING_ENGINE == SERVE_PIO_CPU
+    if( image_sent )
+#else
+    if( gpios_state & ROM_ACCESS_BIT_MASK )
+#endif
+    {
+      rom_image_ptr = (uint8_t *)multicore_fifo_pop_blocking();
+      served_image_ptr = rom_image_ptr;
+
+#if SERVING_ENGINE == SERVE_PIO_CPU
+      /*
+       * If the Z80's in reset anything queued is from before the switch.
+       * If it's a hot swap the Z80 is running and anything queued is a
+       * real ROM read.
+       */
+      if( gpio_get( PICO_RESET_Z80_GP ) )
+	pio_sm_clear_fifos( SNAPSHOT_PIO, SNAPSHOT_SM );
+#endif
 
-  if( ++current_rom_index == num_cycle_roms ) current_rom_index=0;
-  rom_image_ptr = cycle_roms[ current_rom_index ].rom_data;
+      continue;
+    }
 
-  gpio_put( PICO_RESET_Z80_GP, 1 );
-  busy_wait_us_32(5000);
-  gpio_put( PICO_RESET_Z80_GP, 0 );
+#endif
 
-  /* Give this code a moment to get back to the top, then release the Z80 */
-  add_alarm_in_ms( 5, start_z80_alarm_func, NULL, 0 );
+#if SERVING_LOOP_IN_C
 
-  return 0;
-}
+    /*
+     * rom_address is the offset into the ROM image. With PERMUTED_ROM_IMAGES
+     * that's the packed GPIO pattern, not the Z80's address.
+     */
+
+#if SERVING_ENGINE == SERVE_CPU_SPECULATIVE
+
+    /* The lookup was done, and the byte put out, in the spin loop above */
+
+#else
+
+    register uint16_t rom_address = rom_offset_for_gpios( gpios_state );
+
+    register uint8_t rom_value = *(rom_image_ptr+rom_address);
+
+    /* The level shifter is enabled via hardware, so just set the GPIOs */
+    dbus_value = put_data_bus( rom_value, dbus_value );
+
+#endif
+
+#if PAGING_TRAPS
+
+    /*
+     * An opcode fetch, is it a paging trap? See PAGING_TRAPS. This comes
+     * before the deadline monitor so a this_fetch re-drive isn't held up
+     * by it; the monitor then checks the byte the Z80 actually gets.
+     *
+     * Calculated, not measured: at 150MHz the lookup is about 27ns and a
+     * re-drive about 70ns more, against the 430ns M1 window. So the
+     * paging doesn't slow the Z80 down, see the README.
+     */
+    if( !(gpios_state & M1_BIT_MASK) )
+    {
+      register uint8_t trap_action = paging_trap_table[ rom_address ];
+
+      if( trap_action )
+      {
+	if( paging_actions[ trap_action ].page_in )
+	{
+	  rom_image_ptr = paging_actions[ trap_action ].page_in;
+
+	  /* The Z80 hasn't sampled the bus yet, swap the byte for the new image's */
+	  if( paging_actions[ trap_action ].this_fetch )
+	  {
+#if SERVING_ENGINE == SERVE_CPU_SPECULATIVE
+	    rom_value  = put_data_bus( *(rom_image_ptr+rom_address), rom_value );
+#else
+	    dbus_value = put_data_bus( *(rom_image_ptr+rom_address), dbus_value );
+#endif
+	  }
+	}
+
+	paging_trap_hits[ trap_action ]++;
+      }
+    }
+
+#endif
+
+#if DEADLINE_MONITOR
+
+    /* The byte's out. If the Z80 has already finished the read it was too late */
+    if( gpio_get_all() & ROM_ACCESS_BIT_MASK )
+      serving_counters.late_reads++;
+    serving_counters.reads++;
+
+#if DEADLINE_THRESHOLD_CYCLES
+    {
+      /* SysTick counts down */
+      uint32_t cycles = (access_seen - systick_hw->cvr) & 0x00FFFFFF;
+
+      if( cycles > DEADLINE_THRESHOLD_CYCLES )
+	serving_counters.slow_reads++;
+      if( cycles > serving_counters.worst_cycles )
+	serving_counters.worst_cycles = cycles;
+    }
+#endif
+
+#endif
+
+#if M1_AWARE_SERVING
+
+    /*
+     * The byte is out. If this isn't an opcode fetch there's time to do
+     * more while the Z80 finishes the read. See M1_AWARE_SERVING.
+     */
+    if( gpios_state & M1_BIT_MASK )
+    {
+      non_m1_reads++;
+
+      read_trace[ read_trace_head ] = rom_address;
+      read_trace_head = (read_trace_head+1) & (READ_TRACE_LENGTH-1);
+    }
+
+#endif
+
+#if SERVING_ENGINE != SERVE_PIO_CPU
+
+    /*
+     * Spin until the Z80 releases MREQ indicating the read is complete.
+     * ROM_ACCESS is active low - if it's 0 then the ROM is still being accessed.
+     * With SERVE_PIO_CPU the state machine does this.
+     */
+    while( (gpio_get_all() & ROM_ACCESS_BIT_MASK) == 0 );
+
+#endif
+
+#if (SERVING_ENGINE == SERVE_CPU_SPECULATIVE) && SPECULATION_STATS
+
+    /* Was the right byte already out there when the access started? */
+    if( rom_value == previous_rom_value )
+      speculation_hits++;
+    else
+      speculation_misses++;
 
 #endif
 
+#endif /* SERVING_LOOP_IN_C */
+
+    /*
+     * Just leave the value there. The level shifter gets turned off by hardware
+     * which means the value will disappear from the Z80's view when the Z80's
+     * read is complete. At which point the GPIO's state doesn't matter.
+     */
+
+  } /* Infinite loop */
+}
+
 
 int main()
 {
@@ -307,19 +2436,65 @@ int main()
   gpio_init( PICO_RESET_Z80_GP );  gpio_set_dir( PICO_RESET_Z80_GP, GPIO_OUT );
   gpio_put( PICO_RESET_Z80_GP, 1 );
 
-  /* All interrupts off except the timers */
-  irq_set_mask_enabled( 0xFFFFFFFF, 0 );
-  irq_set_mask_enabled( 0x0000000F, 1 );
+#if ZX_IF1_VERSION
+  load_paging_traps( &if1_trap_set );
+#endif
+
+#if !PERMUTED_ROM_IMAGES
+
+#if PRECONVERTED_ROMS
+
+  /* The address indirection table was made at build time, it just needs to be in RAM */
+  memcpy( address_indirection_table, address_indirection_table_image, sizeof(address_indirection_table) );
+
+#else
 
   /* Create address indirection table, this is the address bus optimisation  */
   create_indirection_table();
 
-  /* Buffer to run the preconverted switcher ROM from */
-  uint8_t sw_rom_converted[ sw_rom_len ];
+#endif
+
+#endif
+
+#if SERVING_ENGINE == SERVE_CPU_INTERP
+  setup_interp_address_unpacking();
+#endif
+
+#if !PRECONVERTED_ROMS && !ROM_LIBRARY
 
   /* Switch the bits in the ROM bytes around, this is the data bus optimisation */
   preconvert_roms();
 
+#if !ZX_IF1_VERSION
+  bake_switcher_banners();
+#endif
+
+#endif
+
+#if ZX_IF1_VERSION
+  /* The IF1 ROM over the bottom 8K of the Spectrum ROM, for when it's paged in */
+  build_if1_paged_image( __ROMs_if1_rom, __ROMs_48_original_rom );
+#endif
+
+#if FAST_BOOT
+
+  /*
+   * Pull the buses to zeroes. The data bus is cleared before it's made an
+   * output. There's no mask version of the pull downs.
+   */
+  gpio_init_mask( PIN_ADDR_GPIO_MASK | PIN_DATA_GPIO_MASK | ROM_ACCESS_BIT_MASK );
+  gpio_clr_mask( PIN_DATA_GPIO_MASK );
+  gpio_set_dir_out_masked( PIN_DATA_GPIO_MASK );
+
+  uint32_t gpio;
+  for( gpio=0; gpio<NUM_BANK0_GPIOS; gpio++ )
+  {
+    if( (PIN_ADDR_GPIO_MASK | ROM_ACCESS_BIT_MASK) & (1u << gpio) )
+      gpio_pull_down( gpio );
+  }
+
+#else
+
   /* Pull the buses to zeroes */
   gpio_init( A0_GP  ); gpio_set_dir( A0_GP,  GPIO_IN );  gpio_pull_down( A0_GP  );
   gpio_init( A1_GP  ); gpio_set_dir( A1_GP,  GPIO_IN );  gpio_pull_down( A1_GP  );
@@ -349,7 +2524,17 @@ int main()
   gpio_init( ROM_ACCESS_GP ); gpio_set_dir( ROM_ACCESS_GP, GPIO_IN );
   gpio_pull_down( ROM_ACCESS_GP );
 
-#if !ZX_IF1_VERSION
+#endif
+
+#if M1_AWARE_SERVING
+
+  /* /M1 from the Z80, pulled up so it reads as not-M1 if it isn't connected */
+  gpio_init( M1_GP ); gpio_set_dir( M1_GP, GPIO_IN );
+  gpio_pull_up( M1_GP );
+
+#endif
+
+#if !ZX_IF1_VERSION && !FAST_BOOT
 
   /* Set up Pico's user input pin, pull to zero, switch will send it to 1 */
   gpio_init( PICO_USER_INPUT_GP ); gpio_set_dir( PICO_USER_INPUT_GP, GPIO_IN );
@@ -357,154 +2542,82 @@ int main()
 
 #endif
 
-  /* Blip LED to show we're running */
-  gpio_init(LED_PIN);
-  gpio_set_dir(LED_PIN, GPIO_OUT);
-  int signal;
-  for( signal=0; signal<2; signal++ )
-  {
-    gpio_put(LED_PIN, 1);
-    busy_wait_us_32(250000);
-    gpio_put(LED_PIN, 0);
-    busy_wait_us_32(250000);
-  }
-  gpio_put(LED_PIN, 0);
-
-
-#if !ZX_IF1_VERSION
+#if CLOCK_CALIBRATION
 
-  uint64_t debounce_timestamp_us = 0;
+  /* The Z80's still held in reset, time the serving loop and set the clock to suit */
+  set_sys_clock_khz( calibrate_sys_clock(), 1 );
 
 #endif
 
+#if !FAST_BOOT
+  blip_led();
+#endif
 
-  /*
-   * Ready to go, give it a few milliseconds for this Pico code to get into
-   * its main loop, then let the Z80 start
-   */
-  add_alarm_in_ms( 5, start_z80_alarm_func, NULL, 0 );
-
+#if DBUS_OUTPUT_BENCHMARK
+  benchmark_dbus_output();
+#endif
 
-  while(1)
-  {
-    register uint32_t gpios_state;
 
-#if !ZX_IF1_VERSION
+#if ROM_LIBRARY
 
-    /*
-     * Spin while the hardware is saying at least one of A14, A15 and MREQ is 1.
-     * ROM_ACCESS is active low - if it's 1 then the ROM is not being accessed.
-     * Also break out when the user button is pressed.
-     */
-    while( ( (gpios_state=gpio_get_all()) & ROM_ACCESS_BIT_MASK )
-	   &&
-	   ( (gpios_state & PICO_USER_INPUT_BIT_MASK) == 0 ) );
+  /* The power up ROM is library entry 0, copied out of flash like any other */
+  start_rom_library();
+  rom_image_ptr = select_rom_image( stage_library_image( 0 ), 16384 );
 
-#else
+#elif SERVE_FROM_COPY
 
-    /*
-     * Spin while the hardware is saying at least one of A14, A15 and MREQ is 1.
-     * ROM_ACCESS is active low - if it's 1 then the ROM is not being accessed.
-     */
-    while( (gpios_state=gpio_get_all()) & ROM_ACCESS_BIT_MASK );
+  /* Load the default ROM into the serving buffer */
+  rom_image_ptr = select_rom_image( cycle_roms[ 0 ].rom_data, cycle_roms[ 0 ].rom_size );
 
 #endif
 
+#if SERVING_ENGINE == SERVE_PIO_DMA
 
-#if !ZX_IF1_VERSION
-
-    /* If the user button is pressed, change ROM then reset */
-    if( gpios_state & PICO_USER_INPUT_BIT_MASK )
-    {
-      /* Debounce pause, the switch is a bit noisy */
-      if( (get_time_us() - debounce_timestamp_us) < 50000 )
-      {
-	debounce_timestamp_us = get_time_us();
-      }
-      else
-      {
-	/*
-	 * Switch ROMs. The Pico's LED is lit to show that something is happening,
-	 * the switcher ROM image is loaded to present a label on the Spectrum
-	 * screen, and the ZX is reset. Wait for the button to be released.
-	 */
-
- 	gpio_put(LED_PIN, 1);
-	
-	/*
-	 * Run utility ROM, this isn't one of the cycled ones. The original switcher
-	 * ROM image is copied into the buffer, then the label put in place, then
-	 * the new switcher ROM image is converted to match the data bus pins.
-	 * That's the image that runs.
-	 * The string update is a hack; I just found where the original xxxxx string
-	 * landed in the switcher Z80 code and hardcoded the offset here. Could do
-	 * better. :)
-	 */
-	memcpy( sw_rom_converted, sw_rom, sw_rom_len );
-	memcpy( sw_rom_converted+290, cycle_roms[ current_rom_index ].rom_switcher_label, 32 );
-	preconvert_rom( sw_rom_converted, sw_rom_len );
-	rom_image_ptr = sw_rom_converted;
-
-	gpio_put( PICO_RESET_Z80_GP, 1 );
-	
-	/* Wait for the button to be released. Pause is to debounce */
-	while( (gpio_get_all() & PICO_USER_INPUT_BIT_MASK) );
-	busy_wait_us_32(600000);
-
-	/* Give this code a moment to get back to the top, then release the Z80 */
-	add_alarm_in_ms( 5, start_z80_alarm_func, NULL, 0 );
-
-	gpio_put(LED_PIN, 0);
-
-	/*
-	 * Show the switcher ROM for a moment, then use an alarm to switch in the
-	 * next ROM we're going to cycle to
-	 */
-	add_alarm_in_ms( 1200, switcher_alarm_func, NULL, 0 );
-
-	continue;
-      }
-    }
+  /* Start the PIO and DMA, from here on ROM reads don't involve the CPU */
+  start_pio_dma_engine();
 
-#endif
+#elif SERVING_ENGINE == SERVE_PIO_CPU
 
-    register uint16_t raw_bit_pattern = pack_address_gpios( gpios_state );
+  /* Start catching ROM accesses, they queue in the FIFO until the loop starts */
+  start_pio_snapshot();
 
-    register uint16_t rom_address = address_indirection_table[raw_bit_pattern];
+#endif
 
-    register uint8_t rom_value = *(rom_image_ptr+rom_address);
+  /* Button, ROM switching and starting the Z80 all happen on the other core */
+#if SRAM_PLACEMENT
+  multicore_launch_core1_with_stack( core1_main, core1_stack, sizeof(core1_stack) );
+#else
+  multicore_launch_core1( core1_main );
+#endif
 
-    /* The level shifter is enabled via hardware, so just set the GPIOs */
-    gpio_put_masked( DBUS_MASK, rom_value );
+  /* All interrupts off, the ROM serving on this core needs to run uninterrupted */
+  irq_set_mask_enabled( 0xFFFFFFFF, 0 );
 
-    /*
-     * Spin until the Z80 releases MREQ indicating the read is complete.
-     * ROM_ACCESS is active low - if it's 0 then the ROM is still being accessed.
-     */
-    while( (gpio_get_all() & ROM_ACCESS_BIT_MASK) == 0 );
+#if DEADLINE_THRESHOLD_CYCLES
 
-#if ZX_IF1_VERSION
+  /* SysTick free running at the CPU clock, for timing the reads. Its interrupt stays off */
+  systick_hw->rvr = 0x00FFFFFF;
+  systick_hw->cvr = 0;
+  systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
 
-    if( (rom_address == 0x0008) || (rom_address == 0x1708) )
-    {
-      // gpio_put(LED_PIN, 1);
-      rom_image_ptr = __ROMs_if1_rom;
-    }
-    else if( rom_address == 0x0700 )
-    {
-      rom_image_ptr = __ROMs_48_original_rom;
-      // gpio_put(LED_PIN, 0);
-    }
+#endif
 
+#if !ZX_IF1_VERSION
+  /* What core1 thinks is being served, see send_rom_image() */
+  sent_image_ptr    = rom_image_ptr;
+#if ROM_LIBRARY
+  sent_image_length = 16384;
+#else
+  sent_image_length = cycle_roms[ 0 ].rom_size;
+#endif
+  served_image_ptr  = rom_image_ptr;
 #endif
 
-    /*
-     * Just leave the value there. The level shifter gets turned off by hardware
-     * which means the value will disappear from the Z80's view when the Z80's
-     * read is complete. At which point the GPIO's state doesn't matter.
-     */
+  /* Core1 lets the Z80 go on this */
+  serving_core_ready = true;
 
-  } /* Infinite loop */
+  /* Doesn't return */
+  serve_rom_reads();
 
 }
 
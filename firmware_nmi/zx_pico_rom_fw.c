@@ -31,6 +31,12 @@
 #include "hardware/gpio.h"
 #include "pico/binary_info.h"
 #include "hardware/timer.h"
+#include "pico/multicore.h"
+#include "zx_pico_pins.h"
+#include "hardware/clocks.h"
+#include "hardware/pio.h"
+
+#include "nmi_pulse.pio.h"
 
 
 /* 1 instruction on the 133MHz microprocessor is 7.5ns */
@@ -38,40 +44,96 @@
 /* 1 instruction on the 150MHz microprocessor is 6.6ns */
 /* 1 instruction on the 200MHz microprocessor is 5.0ns */
 
-/* With the debounce counter code in place, 190MHz is needed */
-#define OVERCLOCK 200000
+/*
+ * The button and the NMI are handled on core1, so the serving loop is the
+ * same as the plain ROM firmware's and needs the same overclock. (With
+ * the debounce counter in the serving loop 190MHz was needed.)
+ */
+#define OVERCLOCK 150000
+
+/* The button has to be steady this long before a press or release counts */
+#define DEBOUNCE_US   10000
+
+/*
+ * The NMI pulse is made by a PIO state machine, timed in Z80 T-states.
+ * The Z80 only wants the falling edge, so the width just has to be long
+ * enough to be seen. The lockout stops another NMI following until the
+ * Spectrum has had time to deal with the first one, about 10ms.
+ */
+#define NMI_PULSE_TSTATES    8
+#define NMI_LOCKOUT_TSTATES  35000
+
+/* One store data bus writes, and the startup benchmark of them. See put_data_bus() */
+#define SINGLE_STORE_DBUS      1
+#define DBUS_OUTPUT_BENCHMARK  0
+
+/*
+ * The ROM image is converted for the data bus when the firmware is built,
+ * by board/convert_roms.pl, along with the address indirection table.
+ * Set this to 0 to go back to doing both at startup.
+ */
+#define PRECONVERTED_ROMS 1
+
+/*
+ * roms_converted.h has a permuted copy of each image for the main
+ * firmware. This build looks addresses up in the indirection table, so
+ * it wants the plain ones.
+ */
+#define PERMUTED_ROM_IMAGES 0
 
+/*
+ * Release the Z80 as soon as the ROM emulation is ready, see FAST_BOOT
+ * in the main firmware. The bus GPIOs are set up with mask operations,
+ * and the button, the LED blip and the NMI state machine are left to
+ * core1 until after the Z80 is running. first_rom_access_at_us is when
+ * the first ROM read was seen, in microseconds from power up.
+ */
+#define FAST_BOOT 1
+
+/*
+ * The freezer. The button NMIs the Spectrum straight into a little
+ * monitor in the interface's ROM, whatever it's running, with no NMIADD
+ * POKE needed. See monitor_image. 0 for the old behaviour, where the
+ * button NMI goes to the ROM's handler and from there to NMIADD.
+ */
+#define FREEZER 0
+
+#if PRECONVERTED_ROMS
+#include "roms_converted.h"
+#else
 #include "roms.h"
+#endif
 
 const uint8_t LED_PIN = PICO_DEFAULT_LED_PIN;
 
 /*
  * These pin values are the GPxx ones in green background on the pinout diagram.
- * See schematic for how the signals are fed into the Pico's GPIOs
+ * See schematic for how the signals are fed into the Pico's GPIOs. They come
+ * from board/pin_map.txt, via the generated zx_pico_pins.h.
  */
-const uint8_t A0_GP          = 11;
-const uint8_t A1_GP          = 12;
-const uint8_t A2_GP          = 13;
-const uint8_t A3_GP          = 14;
-const uint8_t A4_GP          = 20;
-const uint8_t A5_GP          = 21;
-const uint8_t A6_GP          = 22;
-const uint8_t A7_GP          = 26;
-const uint8_t A8_GP          = 19;
-const uint8_t A9_GP          = 18;
-const uint8_t A10_GP         = 17;
-const uint8_t A11_GP         = 16;
-const uint8_t A12_GP         = 10;
-const uint8_t A13_GP         = 9;
+const uint8_t A0_GP          = PIN_A0_GP;
+const uint8_t A1_GP          = PIN_A1_GP;
+const uint8_t A2_GP          = PIN_A2_GP;
+const uint8_t A3_GP          = PIN_A3_GP;
+const uint8_t A4_GP          = PIN_A4_GP;
+const uint8_t A5_GP          = PIN_A5_GP;
+const uint8_t A6_GP          = PIN_A6_GP;
+const uint8_t A7_GP          = PIN_A7_GP;
+const uint8_t A8_GP          = PIN_A8_GP;
+const uint8_t A9_GP          = PIN_A9_GP;
+const uint8_t A10_GP         = PIN_A10_GP;
+const uint8_t A11_GP         = PIN_A11_GP;
+const uint8_t A12_GP         = PIN_A12_GP;
+const uint8_t A13_GP         = PIN_A13_GP;
 
 /*
  * Given the GPIOs with an address bus value on them, this packs the
- * 14 address bits down into the least significant 14 bits
+ * 14 address bits down into the least significant 14 bits. The shifts
+ * and masks are generated from the pin map.
  */
 inline uint16_t pack_address_gpios( uint32_t gpios )
 {
-  /*     Bits 0,1,2,3,4,5       Bits 6,7,8,9,10,11,12     Bit 13                   */
-  return ((gpios>>9) & 0x03F) | ((gpios>>10) & 0x1FC0) | ((gpios & 0x4000000) >> 13);
+  return PACK_ADDRESS_GPIOS( gpios );
 }
 
 /*
@@ -100,14 +162,14 @@ uint32_t create_gpios_for_address( uint32_t i )
 }
 
 
-const uint8_t  D0_GP          = 0;
-const uint8_t  D1_GP          = 1;
-const uint8_t  D2_GP          = 2;
-const uint8_t  D3_GP          = 4; 
-const uint8_t  D4_GP          = 6;
-const uint8_t  D5_GP          = 3;
-const uint8_t  D6_GP          = 5;
-const uint8_t  D7_GP          = 7;
+const uint8_t  D0_GP          = PIN_D0_GP;
+const uint8_t  D1_GP          = PIN_D1_GP;
+const uint8_t  D2_GP          = PIN_D2_GP;
+const uint8_t  D3_GP          = PIN_D3_GP;
+const uint8_t  D4_GP          = PIN_D4_GP;
+const uint8_t  D5_GP          = PIN_D5_GP;
+const uint8_t  D6_GP          = PIN_D6_GP;
+const uint8_t  D7_GP          = PIN_D7_GP;
 
 const uint32_t  D0_BIT_MASK  = ((uint32_t)1 <<  D0_GP);
 const uint32_t  D1_BIT_MASK  = ((uint32_t)1 <<  D1_GP);
@@ -118,7 +180,7 @@ const uint32_t  D5_BIT_MASK  = ((uint32_t)1 <<  D5_GP);
 const uint32_t  D6_BIT_MASK  = ((uint32_t)1 <<  D6_GP);
 const uint32_t  D7_BIT_MASK  = ((uint32_t)1 <<  D7_GP);
 
-const uint8_t  ROM_ACCESS_GP            = 8;
+const uint8_t  ROM_ACCESS_GP            = PIN_ROM_ACCESS_GP;
 const uint32_t ROM_ACCESS_BIT_MASK      = ((uint32_t)1 << ROM_ACCESS_GP);
 
 /* This pin triggers a transistor which shorts the Z80's /RESET to ground */
@@ -140,6 +202,54 @@ const uint32_t DBUS_MASK     = ((uint32_t)1 << D0_GP) |
                                ((uint32_t)1 << D6_GP) |
                                ((uint32_t)1 << D7_GP);
 
+/*
+ * Put a ROM byte on the data bus with one store. driven is the byte
+ * already on the bus. gpio_put_masked() has to read gpio_out first, which
+ * puts a dependent SIO read on the critical path; since only this code
+ * drives D0-D7 (GPIO0-7) the difference driven^value is all that needs
+ * toggling. 2 cycles instead of 4. (Byte writes to gpio_out aren't an
+ * option, the RP2040 replicates them across all four byte lanes.)
+ */
+static inline uint8_t put_data_bus( uint8_t value, uint8_t driven )
+{
+#if SINGLE_STORE_DBUS
+  sio_hw->gpio_togl = driven ^ value;
+#else
+  gpio_put_masked( DBUS_MASK, value );
+#endif
+  return value;
+}
+
+#if DBUS_OUTPUT_BENCHMARK
+
+/* Microseconds for 100,000 data bus writes each way, read with the debugger */
+volatile uint32_t dbus_put_masked_us;
+volatile uint32_t dbus_single_store_us;
+
+void benchmark_dbus_output( void )
+{
+  uint32_t i, start;
+  uint8_t  driven = (uint8_t)sio_hw->gpio_out;
+
+  start = time_us_32();
+  for( i=0; i<100000; i++ )
+    gpio_put_masked( DBUS_MASK, (uint8_t)i );
+  dbus_put_masked_us = time_us_32() - start;
+
+  driven = (uint8_t)sio_hw->gpio_out;
+  start = time_us_32();
+  for( i=0; i<100000; i++ )
+  {
+    sio_hw->gpio_togl = driven ^ (uint8_t)i;
+    driven = (uint8_t)i;
+  }
+  dbus_single_store_us = time_us_32() - start;
+
+  gpio_put_masked( DBUS_MASK, 0 );
+}
+
+#endif
+
 /*
  * The 14 address bus bits arrive on the GPIOs in a weird pattern which is
  * defined by the edge connector layout and the board design. Shifting all
@@ -178,11 +288,9 @@ void preconvert_rom( uint8_t *image_ptr, uint32_t length )
   for( conv_index=0; conv_index < length; conv_index++ )
   {
     uint8_t rom_byte = *(image_ptr+conv_index);
-    *(image_ptr+conv_index) =  (rom_byte & 0x87)       |        /* bxxx xbbb */
-                              ((rom_byte & 0x08) << 1) |        /* xxxb xxxx */
-                              ((rom_byte & 0x10) << 2) |        /* xbxx xxxx */
-                              ((rom_byte & 0x20) >> 2) |        /* xxxx bxxx */
-                              ((rom_byte & 0x40) >> 1);         /* xxbx xxxx */
+
+    /* Generated from the pin map, one shift and mask per distance moved */
+    *(image_ptr+conv_index) = DATA_BYTE_TO_GPIOS( rom_byte );
   }
 }
 
@@ -218,6 +326,125 @@ void create_indirection_table( void )
 const uint8_t *rom_image_ptr = __ROMs_48_original_rom;
 
 
+#if FREEZER
+
+/*
+ * The freezer works like the Multiface did. When the button's pressed
+ * core1 arms a trap on 0x0066 and fires the NMI. The Z80's fetch from
+ * 0x0066 hits the trap and the monitor image is paged in: the Spectrum
+ * ROM with a jump to the monitor at 0x0066, and the monitor itself in
+ * the ROM's free space at 0x3900. The monitor ends with RETN, and reading
+ * RETN's second byte is the trap which pages the Spectrum ROM back in.
+ * The Z80 goes back to what it was doing none the wiser.
+ *
+ * The main firmware only pages on opcode fetches, but that needs /M1 and
+ * on this board /M1's GPIO is the NMI output. So the page in trap is one
+ * shot, armed by core1 just before each NMI and disarmed by the serving
+ * loop when it's hit. The first read of 0x0066 after the NMI is the
+ * fetch, the pushes of PC go to RAM. If the running program happened to
+ * read 0x0066 between the arming and the NMI that's harmless, the monitor
+ * image is the Spectrum ROM everywhere except the jump and the monitor.
+ * The page out trap stays in the table but only counts while the monitor
+ * image is paged in. A program reading 0x3925 as data (a checksum, say)
+ * is just served the Spectrum ROM's byte.
+ *
+ * The monitor freezes the Spectrum with the border striping until SPACE
+ * is pressed and released, puts the border back and returns:
+ *
+ *   3900  push af
+ *         push bc
+ *         ld b,0
+ *   3904  ld a,b          ; stripe the border
+ *         and 7
+ *         out (254),a
+ *         inc b
+ *         ld a,0x7f       ; until SPACE goes down
+ *         in a,(254)
+ *         rra
+ *         jr c,3904
+ *   3911  ld a,0x7f       ; and back up
+ *         in a,(254)
+ *         rra
+ *         jr nc,3911
+ *   3918  ld a,(23624)    ; BORDCR, border colour is bits 3-5
+ *         rra
+ *         rra
+ *         rra
+ *         and 7
+ *         out (254),a
+ *         pop bc
+ *         pop af
+ *   3924  retn
+ *
+ * It uses 4 bytes of the frozen program's stack, on top of the 2 the NMI
+ * uses. A bigger monitor just needs to end with RETN, FREEZER_EXIT is
+ * worked out from its length.
+ */
+#define FREEZER_ENTRY       0x0066
+#define FREEZER_MONITOR_AT  0x3900
+
+const uint8_t freezer_monitor_code[] =
+{
+  0xf5, 0xc5, 0x06, 0x00,
+  0x78, 0xe6, 0x07, 0xd3, 0xfe, 0x04, 0x3e, 0x7f, 0xdb, 0xfe, 0x1f, 0x38, 0xf3,
+  0x3e, 0x7f, 0xdb, 0xfe, 0x1f, 0x30, 0xf9,
+  0x3a, 0x48, 0x5c, 0x1f, 0x1f, 0x1f, 0xe6, 0x07, 0xd3, 0xfe,
+  0xc1, 0xf1,
+  0xed, 0x45,
+};
+
+#define FREEZER_EXIT  (FREEZER_MONITOR_AT + sizeof(freezer_monitor_code) - 1)
+
+uint8_t monitor_image[ 16384 ];
+
+/* What the serving loop does when it reads a trapped address */
+enum { FREEZER_PAGE_IN = 1, FREEZER_PAGE_OUT };
+
+/* The trap for each ROM address, 0 for none. Core1 writes the page in one */
+volatile uint8_t freezer_trap_table[ 16384 ];
+
+/* How many times each trap's done something, read it with the debugger */
+volatile uint32_t freezer_trap_hits[ 3 ];
+
+/* Set by the serving loop when it pages the monitor in, cleared when it pages it out */
+volatile bool freezer_in_monitor = false;
+
+/* Put a Z80 program into a converted image, this version doesn't permute */
+void poke_converted( uint8_t *image_ptr, uint16_t z80_address, const uint8_t *bytes, uint32_t length )
+{
+  uint32_t i;
+
+  for( i=0; i<length; i++ )
+    image_ptr[ z80_address+i ] = DATA_BYTE_TO_GPIOS( bytes[i] );
+}
+
+/* Call once the Spectrum ROM's been converted */
+void build_monitor_image( void )
+{
+  const uint8_t jump_to_monitor[] = { 0xc3, FREEZER_MONITOR_AT & 0xFF, FREEZER_MONITOR_AT >> 8 };
+
+  memcpy( monitor_image, __ROMs_48_original_rom, sizeof(monitor_image) );
+  poke_converted( monitor_image, FREEZER_ENTRY,      jump_to_monitor,      sizeof(jump_to_monitor) );
+  poke_converted( monitor_image, FREEZER_MONITOR_AT, freezer_monitor_code, sizeof(freezer_monitor_code) );
+
+  freezer_trap_table[ FREEZER_EXIT ] = FREEZER_PAGE_OUT;
+}
+
+/* In the monitor, or on the way in. The Spectrum's stack can't take another freeze */
+bool freezer_frozen( void )
+{
+  return (freezer_trap_table[ FREEZER_ENTRY ] != 0) || freezer_in_monitor;
+}
+
+#endif
+
+
+/*
+ * Microseconds from power up to the Z80 first being let out of reset.
+ * Read it with the debugger.
+ */
+volatile uint32_t z80_released_at_us = 0;
+
 /*
  * This is called by an alarm function. It lets the Z80 run by pulling the
  * Pico's controlling GPIO low
@@ -225,9 +452,169 @@ const uint8_t *rom_image_ptr = __ROMs_48_original_rom;
 int64_t start_z80_alarm_func( alarm_id_t id, void *user_data )
 {
   gpio_put( PICO_RESET_Z80_GP, 0 );
+
+  if( z80_released_at_us == 0 )
+    z80_released_at_us = time_us_32();
+
   return 0;
 }
 
+/* Zero if the first ROM read didn't come within a tenth of a second of the Z80 being released */
+volatile uint32_t first_rom_access_at_us = 0;
+
+/* Called on core1 at startup, waits for the Z80 to be released then for its first ROM read */
+void time_first_rom_access( void )
+{
+  while( z80_released_at_us == 0 );
+
+  /* ROM_ACCESS is active low */
+  while( gpio_get( ROM_ACCESS_GP ) )
+  {
+    if( (time_us_32() - z80_released_at_us) > 100000 )
+      return;
+  }
+  first_rom_access_at_us = time_us_32();
+}
+
+/* Blip LED to show we're running */
+void blip_led( void )
+{
+  gpio_init(LED_PIN);
+  gpio_set_dir(LED_PIN, GPIO_OUT);
+  int signal;
+  for( signal=0; signal<2; signal++ )
+  {
+    gpio_put(LED_PIN, 1);
+    busy_wait_us_32(250000);
+    gpio_put(LED_PIN, 0);
+    busy_wait_us_32(250000);
+  }
+  gpio_put(LED_PIN, 0);
+}
+
+
+/* The NMI pulse generator, see nmi_pulse.pio */
+PIO  nmi_pio;
+uint nmi_sm;
+
+void start_nmi_pulse_sm( void )
+{
+  nmi_pio = pio0;
+
+  uint nmi_offset = pio_add_program( nmi_pio, &nmi_pulse_program );
+
+  nmi_sm = pio_claim_unused_sm( nmi_pio, true );
+  nmi_pulse_program_init( nmi_pio, nmi_sm, nmi_offset, NMI_GP );
+  pio_sm_set_enabled( nmi_pio, nmi_sm, true );
+}
+
+/*
+ * Ask for an NMI. The PIO does the timing, and ignores the request if
+ * it's still in the lockout from the previous one.
+ */
+void fire_nmi( void )
+{
+  if( !pio_sm_is_tx_fifo_full( nmi_pio, nmi_sm ) )
+    pio_sm_put( nmi_pio, nmi_sm, nmi_pulse_request( NMI_PULSE_TSTATES, NMI_LOCKOUT_TSTATES ) );
+}
+
+/*
+ * Wait for the user button to reach the given state and stay there for
+ * DEBOUNCE_US. The switch is a bit noisy.
+ */
+void wait_for_button( bool pressed )
+{
+  uint32_t steady_since_us;
+
+  do
+  {
+    while( gpio_get( PICO_USER_INPUT_GP ) != pressed );
+
+    steady_since_us = time_us_32();
+    while( (gpio_get( PICO_USER_INPUT_GP ) == pressed) && ((time_us_32() - steady_since_us) < DEBOUNCE_US) );
+  }
+  while( gpio_get( PICO_USER_INPUT_GP ) != pressed );
+}
+
+/* Set by core0 just before it goes into the ROM emulation loop */
+volatile bool serving_core_ready = false;
+
+/*
+ * ROM emulation runs on the other core with all interrupts off. This core
+ * starts the Z80, watches the button and fires the NMI. Nothing here can
+ * hold up a ROM read, so the debounce can take as long as it likes and
+ * is timed in real microseconds.
+ */
+void core1_main( void )
+{
+  /* All interrupts off on this core except the timers */
+  irq_set_mask_enabled( 0xFFFFFFFF, 0 );
+  irq_set_mask_enabled( 0x0000000F, 1 );
+
+#if FAST_BOOT
+
+  /* The ROM emulation is a few instructions from its loop, that's quicker than the Z80 comes out of reset */
+  while( !serving_core_ready );
+  start_z80_alarm_func( 0, NULL );
+  time_first_rom_access();
+
+#if FREEZER
+  build_monitor_image();
+#endif
+
+  /*
+   * The NMI pin's held inactive by the SIO until the PIO takes it over,
+   * and the PIO sets it inactive first, so the Z80 running doesn't matter
+   */
+  start_nmi_pulse_sm();
+
+  /* Set up Pico's user input pin, pull to zero, switch will send it to 1 */
+  gpio_init( PICO_USER_INPUT_GP ); gpio_set_dir( PICO_USER_INPUT_GP, GPIO_IN );
+  gpio_pull_down( PICO_USER_INPUT_GP );
+
+  blip_led();
+
+#else
+
+#if FREEZER
+  build_monitor_image();
+#endif
+
+  /* The Z80 is still in reset, so the handover of the NMI pin can't upset it */
+  start_nmi_pulse_sm();
+
+  /*
+   * Ready to go, give it a few milliseconds for the ROM emulation to get
+   * into its main loop, then let the Z80 start
+   */
+  add_alarm_in_ms( 5, start_z80_alarm_func, NULL, 0 );
+  time_first_rom_access();
+
+#endif
+
+  while(1)
+  {
+    wait_for_button( true );
+
+    /* One NMI per press. The LED stays on until the button's released */
+    gpio_put(LED_PIN, 1);
+
+#if FREEZER
+    if( !freezer_frozen() )
+    {
+      freezer_trap_table[ FREEZER_ENTRY ] = FREEZER_PAGE_IN;
+      fire_nmi();
+    }
+#else
+    fire_nmi();
+#endif
+
+    wait_for_button( false );
+
+    gpio_put(LED_PIN, 0);
+  }
+}
+
 
 int main()
 {
@@ -245,9 +632,12 @@ int main()
   gpio_init( PICO_RESET_Z80_GP );  gpio_set_dir( PICO_RESET_Z80_GP, GPIO_OUT );
   gpio_put( PICO_RESET_Z80_GP, 1 );
 
-  /* All interrupts off except the timers */
-  irq_set_mask_enabled( 0xFFFFFFFF, 0 );
-  irq_set_mask_enabled( 0x0000000F, 1 );
+#if PRECONVERTED_ROMS
+
+  /* The address indirection table was made at build time, it just needs to be in RAM */
+  memcpy( address_indirection_table, address_indirection_table_image, sizeof(address_indirection_table) );
+
+#else
 
   /* Create address indirection table, this is the address bus optimisation  */
   create_indirection_table();
@@ -255,6 +645,28 @@ int main()
   /* Switch the bits in the ROM bytes around, this is the data bus optimisation */
   preconvert_rom( __ROMs_48_original_rom, 16384 );
 
+#endif
+
+#if FAST_BOOT
+
+  /* Pull the buses to zeroes. The data bus is cleared before it's made an output */
+  gpio_init_mask( PIN_ADDR_GPIO_MASK | PIN_DATA_GPIO_MASK | ROM_ACCESS_BIT_MASK );
+  gpio_clr_mask( PIN_DATA_GPIO_MASK );
+  gpio_set_dir_out_masked( PIN_DATA_GPIO_MASK );
+
+  uint32_t gpio;
+  for( gpio=0; gpio<NUM_BANK0_GPIOS; gpio++ )
+  {
+    if( (PIN_ADDR_GPIO_MASK | ROM_ACCESS_BIT_MASK) & (1u << gpio) )
+      gpio_pull_down( gpio );
+  }
+
+#if DBUS_OUTPUT_BENCHMARK
+  benchmark_dbus_output();
+#endif
+
+#else
+
   /* Pull the buses to zeroes */
   gpio_init( A0_GP  ); gpio_set_dir( A0_GP,  GPIO_IN );  gpio_pull_down( A0_GP  );
   gpio_init( A1_GP  ); gpio_set_dir( A1_GP,  GPIO_IN );  gpio_pull_down( A1_GP  );
@@ -280,6 +692,10 @@ int main()
   gpio_init( D6_GP  ); gpio_set_dir( D6_GP,  GPIO_OUT ); gpio_put( D6_GP, 0 );
   gpio_init( D7_GP  ); gpio_set_dir( D7_GP,  GPIO_OUT ); gpio_put( D7_GP, 0 );
 
+#if DBUS_OUTPUT_BENCHMARK
+  benchmark_dbus_output();
+#endif
+
   /* Input from logic hardware, indicates the ROM is being accessed by the Z80 */
   gpio_init( ROM_ACCESS_GP ); gpio_set_dir( ROM_ACCESS_GP, GPIO_IN );
   gpio_pull_down( ROM_ACCESS_GP );
@@ -288,36 +704,29 @@ int main()
   gpio_init( PICO_USER_INPUT_GP ); gpio_set_dir( PICO_USER_INPUT_GP, GPIO_IN );
   gpio_pull_down( PICO_USER_INPUT_GP );
 
-  /* Set NMI output inactive */
+#endif
+
+  /* Set NMI output inactive, this has to be done before the Z80 runs */
   gpio_init( NMI_GP ); gpio_set_dir( NMI_GP, GPIO_OUT );
   gpio_put( NMI_GP, 1 );
 
-  /* Blip LED to show we're running */
-  gpio_init(LED_PIN);
-  gpio_set_dir(LED_PIN, GPIO_OUT);
-  int signal;
-  for( signal=0; signal<2; signal++ )
-  {
-    gpio_put(LED_PIN, 1);
-    busy_wait_us_32(250000);
-    gpio_put(LED_PIN, 0);
-    busy_wait_us_32(250000);
-  }
-  gpio_put(LED_PIN, 0);
+#if !FAST_BOOT
+  blip_led();
+#endif
 
 
-  uint64_t debounce_timestamp_us = 0;
+  /* The button, the NMI and starting the Z80 are all on the other core */
+  multicore_launch_core1( core1_main );
 
+  /* All interrupts off, the ROM emulation on this core needs to run uninterrupted */
+  irq_set_mask_enabled( 0xFFFFFFFF, 0 );
 
-  /*
-   * Ready to go, give it a few milliseconds for this Pico code to get into
-   * its main loop, then let the Z80 start
-   */
-  add_alarm_in_ms( 5, start_z80_alarm_func, NULL, 0 );
+  /* The byte currently on the data bus GPIOs */
+  register uint8_t dbus_value = (uint8_t)sio_hw->gpio_out;
+
+  /* Core1 lets the Z80 go on this */
+  serving_core_ready = true;
 
-  uint8_t  user_button_pressed = 0;
-  uint32_t debounce_counter = 0;
-  uint8_t  nmi_asserted = 0;
   while(1)
   {
     register uint32_t gpios_state;
@@ -325,96 +734,53 @@ int main()
     /*
      * Spin while the hardware is saying at least one of A14, A15 and MREQ is 1.
      * ROM_ACCESS is active low - if it's 1 then the ROM is not being accessed.
-     * Also break out when the user button is pressed.
      */
-    while( ( (gpios_state=gpio_get_all()) & ROM_ACCESS_BIT_MASK )
-	   &&
-	   ( (gpios_state & PICO_USER_INPUT_BIT_MASK) == 0 ) );
-
-    if( !(gpios_state & ROM_ACCESS_BIT_MASK) )
-    {
-      register uint16_t raw_bit_pattern = pack_address_gpios( gpios_state );
+    while( (gpios_state=gpio_get_all()) & ROM_ACCESS_BIT_MASK );
 
-      register uint16_t rom_address = address_indirection_table[raw_bit_pattern];
+    register uint16_t raw_bit_pattern = pack_address_gpios( gpios_state );
 
-      register uint8_t rom_value = *(rom_image_ptr+rom_address);
+    register uint16_t rom_address = address_indirection_table[raw_bit_pattern];
 
-      /* The level shifter is enabled via hardware, so just set the GPIOs */
-      gpio_put_masked( DBUS_MASK, rom_value );
+    register uint8_t rom_value = *(rom_image_ptr+rom_address);
 
-      /*
-       * Spin until the Z80 releases MREQ indicating the read is complete.
-       * ROM_ACCESS is active low - if it's 0 then the ROM is still being accessed.
-       */
-      while( (gpio_get_all() & ROM_ACCESS_BIT_MASK) == 0 );
+    /* The level shifter is enabled via hardware, so just set the GPIOs */
+    dbus_value = put_data_bus( rom_value, dbus_value );
 
-      /*
-       * Just leave the value there. The level shifter gets turned off by hardware
-       * which means the value will disappear from the Z80's view when the Z80's
-       * read is complete. At which point the GPIO's state doesn't matter.
-       */
+#if FREEZER
+    /*
+     * The freezer's traps, see monitor_image. The byte's already out, so
+     * this doesn't delay the read. Paging in, the byte comes from the
+     * monitor image instead; the Z80 doesn't sample the bus until the
+     * end of T2, so there's time to change it.
+     */
+    register uint8_t trap = freezer_trap_table[rom_address];
+    if( trap == FREEZER_PAGE_IN )
+    {
+      freezer_trap_table[ FREEZER_ENTRY ] = 0;
+      rom_image_ptr = monitor_image;
+      dbus_value = put_data_bus( *(rom_image_ptr+rom_address), dbus_value );
+      freezer_in_monitor = true;
+      freezer_trap_hits[ trap ]++;
     }
+    else if( (trap == FREEZER_PAGE_OUT) && (rom_image_ptr == monitor_image) )
+    {
+      rom_image_ptr = __ROMs_48_original_rom;
+      freezer_in_monitor = false;
+      freezer_trap_hits[ trap ]++;
+    }
+#endif
 
     /*
-     * The above section deals with a ROM read if their was one. It will have
-     * waited until the Z80 is finished (MREQ going inactive), then we drop to
-     * here. There's a small bit of time when other stuff can be done, but the
-     * Z80 is possibly already preparing the next ROM read, so whatever happens
-     * below this point needs to be quick.
-     * Note that the Pico example get_time_us() function, which I was using for
-     * the switch debounce, takes 1.5uS, which is too slow.
+     * Spin until the Z80 releases MREQ indicating the read is complete.
+     * ROM_ACCESS is active low - if it's 0 then the ROM is still being accessed.
      */
+    while( (gpio_get_all() & ROM_ACCESS_BIT_MASK) == 0 );
 
     /*
-     * If NMI was asserted, turn it off. NMI causes the Z80 to jump to 0x0066
-     * which is in the ROM, so it's guaranteed that when NMI is asserted the
-     * Pico will come back round this loop next iteration. Turning NMI off here
-     * means it was asserted for one Z80 memory read instruction.
+     * Just leave the value there. The level shifter gets turned off by hardware
+     * which means the value will disappear from the Z80's view when the Z80's
+     * read is complete. At which point the GPIO's state doesn't matter.
      */
-    if( nmi_asserted )
-    {
-      gpio_put(NMI_GP, 1);
-      nmi_asserted = 0;
-
-      gpio_put(LED_PIN, 0);
-    }
-
-    /* If the user button is pressed, fire the NMI */
-    if( gpios_state & PICO_USER_INPUT_BIT_MASK )
-    {
-      if( !user_button_pressed )
-      {
-	/*
-	 * Debounce with a counter, the switch is a bit noisy. Wait for this
-	 * many iterations of the loop to complete with the button down before
-	 * deciding the button is really down.
-	 * Value was empirically found.
-	 */
-	if( ++debounce_counter == 1000 )
-	{
-	  gpio_put(LED_PIN, 1);
-	
-	  user_button_pressed = 1;
-
-	  gpio_put(NMI_GP, 0);
-	  nmi_asserted = 1;
-	}
-      }
-    }
-    else if( (gpios_state & PICO_USER_INPUT_BIT_MASK) == 0 )
-    {	
-      if( user_button_pressed )
-      {
-	/* Was pressed, now isn't, it's been released */
-	user_button_pressed = 0;
-	debounce_counter = 0;
-      }
-      else
-      {
-	/* Button is not pressed (or has bounced "off"), reset the counter */
-	debounce_counter = 0;
-      }
-    }
 
   } /* Infinite loop */
 
@@ -36,6 +36,7 @@
 #include <stdlib.h>
 #include "pico/stdlib.h"
 #include "pico/multicore.h"
+#include "zx_pico_pins.h"
 #include "hardware/gpio.h"
 #include "pico/binary_info.h"
 #include "hardware/timer.h"
@@ -58,37 +59,60 @@
 #define PIO_DIVIDER ((OVERCLOCK_KHZ/125000.0)*1000.0)
 #endif
 
+/* One store data bus writes, and the startup benchmark of them. See put_data_bus() */
+#define SINGLE_STORE_DBUS      1
+#define DBUS_OUTPUT_BENCHMARK  0
+
+/*
+ * The ROM image is converted for the data bus when the firmware is built,
+ * by board/convert_roms.pl, along with the address indirection table.
+ * Set this to 0 to go back to doing both at startup.
+ */
+#define PRECONVERTED_ROMS 1
+
+/*
+ * roms_converted.h has a permuted copy of each image for the main
+ * firmware. This build looks addresses up in the indirection table, so
+ * it wants the plain ones.
+ */
+#define PERMUTED_ROM_IMAGES 0
+
+#if PRECONVERTED_ROMS
+#include "roms_converted.h"
+#else
 #include "roms.h"
+#endif
 
 const uint8_t LED_PIN = PICO_DEFAULT_LED_PIN;
 
 /*
  * These pin values are the GPxx ones in green background on the pinout diagram.
- * See schematic for how the signals are fed into the Pico's GPIOs
+ * See schematic for how the signals are fed into the Pico's GPIOs. They come
+ * from board/pin_map.txt, via the generated zx_pico_pins.h.
  */
-const uint8_t A0_GP          = 11;
-const uint8_t A1_GP          = 12;
-const uint8_t A2_GP          = 13;
-const uint8_t A3_GP          = 14;
-const uint8_t A4_GP          = 20;
-const uint8_t A5_GP          = 21;
-const uint8_t A6_GP          = 22;
-const uint8_t A7_GP          = 26;
-const uint8_t A8_GP          = 19;
-const uint8_t A9_GP          = 18;
-const uint8_t A10_GP         = 17;
-const uint8_t A11_GP         = 16;
-const uint8_t A12_GP         = 10;
-const uint8_t A13_GP         = 9;
+const uint8_t A0_GP          = PIN_A0_GP;
+const uint8_t A1_GP          = PIN_A1_GP;
+const uint8_t A2_GP          = PIN_A2_GP;
+const uint8_t A3_GP          = PIN_A3_GP;
+const uint8_t A4_GP          = PIN_A4_GP;
+const uint8_t A5_GP          = PIN_A5_GP;
+const uint8_t A6_GP          = PIN_A6_GP;
+const uint8_t A7_GP          = PIN_A7_GP;
+const uint8_t A8_GP          = PIN_A8_GP;
+const uint8_t A9_GP          = PIN_A9_GP;
+const uint8_t A10_GP         = PIN_A10_GP;
+const uint8_t A11_GP         = PIN_A11_GP;
+const uint8_t A12_GP         = PIN_A12_GP;
+const uint8_t A13_GP         = PIN_A13_GP;
 
 /*
  * Given the GPIOs with an address bus value on them, this packs the
- * 14 address bits down into the least significant 14 bits
+ * 14 address bits down into the least significant 14 bits. The shifts
+ * and masks are generated from the pin map.
  */
 inline uint16_t pack_address_gpios( uint32_t gpios )
 {
-  /*     Bits 0,1,2,3,4,5       Bits 6,7,8,9,10,11,12     Bit 13                   */
-  return ((gpios>>9) & 0x03F) | ((gpios>>10) & 0x1FC0) | ((gpios & 0x4000000) >> 13);
+  return PACK_ADDRESS_GPIOS( gpios );
 }
 
 /*
@@ -117,14 +141,14 @@ uint32_t create_gpios_for_address( uint32_t i )
 }
 
 
-const uint8_t  D0_GP          = 0;
-const uint8_t  D1_GP          = 1;
-const uint8_t  D2_GP          = 2;
-const uint8_t  D3_GP          = 4; 
-const uint8_t  D4_GP          = 6;
-const uint8_t  D5_GP          = 3;
-const uint8_t  D6_GP          = 5;
-const uint8_t  D7_GP          = 7;
+const uint8_t  D0_GP          = PIN_D0_GP;
+const uint8_t  D1_GP          = PIN_D1_GP;
+const uint8_t  D2_GP          = PIN_D2_GP;
+const uint8_t  D3_GP          = PIN_D3_GP;
+const uint8_t  D4_GP          = PIN_D4_GP;
+const uint8_t  D5_GP          = PIN_D5_GP;
+const uint8_t  D6_GP          = PIN_D6_GP;
+const uint8_t  D7_GP          = PIN_D7_GP;
 
 const uint32_t  D0_BIT_MASK  = ((uint32_t)1 <<  D0_GP);
 const uint32_t  D1_BIT_MASK  = ((uint32_t)1 <<  D1_GP);
@@ -135,7 +159,7 @@ const uint32_t  D5_BIT_MASK  = ((uint32_t)1 <<  D5_GP);
 const uint32_t  D6_BIT_MASK  = ((uint32_t)1 <<  D6_GP);
 const uint32_t  D7_BIT_MASK  = ((uint32_t)1 <<  D7_GP);
 
-const uint8_t  ROM_ACCESS_GP            = 8;
+const uint8_t  ROM_ACCESS_GP            = PIN_ROM_ACCESS_GP;
 const uint32_t ROM_ACCESS_BIT_MASK      = ((uint32_t)1 << ROM_ACCESS_GP);
 
 /* This pin triggers a transistor which shorts the Z80's /RESET to ground */
@@ -156,6 +180,54 @@ const uint32_t DBUS_MASK     = ((uint32_t)1 << D0_GP) |
                                ((uint32_t)1 << D6_GP) |
                                ((uint32_t)1 << D7_GP);
 
+/*
+ * Put a ROM byte on the data bus with one store. driven is the byte
+ * already on the bus. gpio_put_masked() has to read gpio_out first, which
+ * puts a dependent SIO read on the critical path; since only this code
+ * drives D0-D7 (GPIO0-7) the difference driven^value is all that needs
+ * toggling. 2 cycles instead of 4. (Byte writes to gpio_out aren't an
+ * option, the RP2040 replicates them across all four byte lanes.)
+ */
+static inline uint8_t put_data_bus( uint8_t value, uint8_t driven )
+{
+#if SINGLE_STORE_DBUS
+  sio_hw->gpio_togl = driven ^ value;
+#else
+  gpio_put_masked( DBUS_MASK, value );
+#endif
+  return value;
+}
+
+#if DBUS_OUTPUT_BENCHMARK
+
+/* Microseconds for 100,000 data bus writes each way, read with the debugger */
+volatile uint32_t dbus_put_masked_us;
+volatile uint32_t dbus_single_store_us;
+
+void benchmark_dbus_output( void )
+{
+  uint32_t i, start;
+  uint8_t  driven = (uint8_t)sio_hw->gpio_out;
+
+  start = time_us_32();
+  for( i=0; i<100000; i++ )
+    gpio_put_masked( DBUS_MASK, (uint8_t)i );
+  dbus_put_masked_us = time_us_32() - start;
+
+  driven = (uint8_t)sio_hw->gpio_out;
+  start = time_us_32();
+  for( i=0; i<100000; i++ )
+  {
+    sio_hw->gpio_togl = driven ^ (uint8_t)i;
+    driven = (uint8_t)i;
+  }
+  dbus_single_store_us = time_us_32() - start;
+
+  gpio_put_masked( DBUS_MASK, 0 );
+}
+
+#endif
+
 /*
  * The 14 address bus bits arrive on the GPIOs in a weird pattern which is
  * defined by the edge connector layout and the board design. Shifting all
@@ -194,11 +266,9 @@ void preconvert_rom( uint8_t *image_ptr, uint32_t length )
   for( conv_index=0; conv_index < length; conv_index++ )
   {
     uint8_t rom_byte = *(image_ptr+conv_index);
-    *(image_ptr+conv_index) =  (rom_byte & 0x87)       |        /* bxxx xbbb */
-                              ((rom_byte & 0x08) << 1) |        /* xxxb xxxx */
-                              ((rom_byte & 0x10) << 2) |        /* xbxx xxxx */
-                              ((rom_byte & 0x20) >> 2) |        /* xxxx bxxx */
-                              ((rom_byte & 0x40) >> 1);         /* xxbx xxxx */
+
+    /* Generated from the pin map, one shift and mask per distance moved */
+    *(image_ptr+conv_index) = DATA_BYTE_TO_GPIOS( rom_byte );
   }
 }
 
@@ -335,12 +405,21 @@ int main()
   gpio_init( PICO_RESET_Z80_GP );  gpio_set_dir( PICO_RESET_Z80_GP, GPIO_OUT );
   gpio_put( PICO_RESET_Z80_GP, 1 );
 
+#if PRECONVERTED_ROMS
+
+  /* The address indirection table was made at build time, it just needs to be in RAM */
+  memcpy( address_indirection_table, address_indirection_table_image, sizeof(address_indirection_table) );
+
+#else
+
   /* Create address indirection table, this is the address bus optimisation  */
   create_indirection_table();
 
   /* Switch the bits in the ROM bytes around, this is the data bus optimisation */
   preconvert_rom( __ROMs_48_original_rom, 16384 );
 
+#endif
+
   /* Pull the buses to zeroes */
   gpio_init( A0_GP  ); gpio_set_dir( A0_GP,  GPIO_IN );  gpio_pull_down( A0_GP  );
   gpio_init( A1_GP  ); gpio_set_dir( A1_GP,  GPIO_IN );  gpio_pull_down( A1_GP  );
@@ -366,6 +445,10 @@ int main()
   gpio_init( D6_GP  ); gpio_set_dir( D6_GP,  GPIO_OUT ); gpio_put( D6_GP, 0 );
   gpio_init( D7_GP  ); gpio_set_dir( D7_GP,  GPIO_OUT ); gpio_put( D7_GP, 0 );
 
+#if DBUS_OUTPUT_BENCHMARK
+  benchmark_dbus_output();
+#endif
+
   /* Input from logic hardware, indicates the ROM is being accessed by the Z80 */
   gpio_init( ROM_ACCESS_GP ); gpio_set_dir( ROM_ACCESS_GP, GPIO_IN );
   gpio_pull_down( ROM_ACCESS_GP );
@@ -393,6 +476,9 @@ int main()
   /* All interrupts off, the ROM emulation on this core needs to run uninterrupted */
   irq_set_mask_enabled( 0xFFFFFFFF, 0 );
 
+  /* The byte currently on the data bus GPIOs */
+  register uint8_t dbus_value = (uint8_t)sio_hw->gpio_out;
+
   while(1)
   {
     register uint32_t gpios_state;
@@ -411,7 +497,7 @@ int main()
     register uint8_t rom_value = *(rom_image_ptr+rom_address);
 
     /* The level shifter is enabled via hardware, so just set the GPIOs */
-    gpio_put_masked( DBUS_MASK, rom_value );
+    dbus_value = put_data_bus( rom_value, dbus_value );
 
     /*
      * Spin until the Z80 releases MREQ indicating the read is complete.